@@ -16,6 +16,11 @@
 ** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 **/
 
+/* struct ucred of SO_PEERCRED */
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE
+#endif
+
 #include "sysinc.h"
 #include "module.h"
 #include "zbxjson.h"
@@ -23,7 +28,9 @@
 #include "memalloc.h"
 #include "log.h"
 #include "zbxalgo.h"
+#include "cfg.h"
 #include <curl/curl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <libdeltacloud/libdeltacloud.h>
@@ -34,16 +41,58 @@
 #define PUBLIC_ADDR_MACRO "{#INSTANCE.PUBLIC_ADDR}"
 #define PRIVATE_ADDR_MACRO "{#INSTANCE.PRIVATE_ADDR}"
 #define CONFIG_FILE "/usr/local/zabbix/2.1.7/etc/zabbix_agentd.conf"
+#define MODULE_CONFIG_FILE "/usr/local/zabbix/2.1.7/etc/cloud_discovery.conf"
+#define CACHE_SOCKET "/var/run/zabbix/zabbix_cloud_discovery.sock"
+#define CACHE_TIMEOUT 30
+#define CACHE_MAX_MESSAGE 16 * ZBX_MEBIBYTE
 #define MEM_SIZE 1048576
 #define EXPIRE_TIME 60*60*24
 
+/* instances formatted per cache lock by cloud.instance.export */
+#define CLOUD_EXPORT_BATCH	100
+/* times cloud.instance.export starts over when the service changes meanwhile */
+#define CLOUD_EXPORT_RETRIES	5
+
+/* older Zabbix headers do not define it */
+#ifndef ZBX_UNUSED
+#	define ZBX_UNUSED(var)	(void)(var)
+#endif
+
 /* the variable keeps timeout setting for item processing */
 static int	item_timeout = 0;
 
+#define CLOUD_CACHE_MODE_LOCAL	0	/* the agent keeps its own cache */
+#define CLOUD_CACHE_MODE_SERVER	1	/* the agent keeps the cache and serves other agents */
+#define CLOUD_CACHE_MODE_CLIENT	2	/* the agent forwards items to the cache server */
+
+static int	cache_mode = CLOUD_CACHE_MODE_LOCAL;
+
+/* module configuration parameters */
+static char	*CONFIG_CACHE_MODE = NULL;
+static char	*CONFIG_CACHE_SOCKET = NULL;
+static int	CONFIG_REFRESH_INTERVAL = 0;
+static int	CONFIG_ENABLE_STRESS_TEST = 0;
+static int	CONFIG_COMPACTION_THRESHOLD = 0;
+static int	CONFIG_REFRESH_COLLECTIONS = 1;
+static int	CONFIG_BREAKER_THRESHOLD = 3;
+static int	CONFIG_BREAKER_PROBE_INTERVAL = 60;
+static int	CONFIG_LOCAL_VIEW = 0;
+static int	CONFIG_COLD_FIELDS_TIMEOUT = SEC_PER_HOUR;
+static zbx_uint64_t	CONFIG_SERVICE_MEMORY_LIMIT = 0;
+static int	CONFIG_STATE_CHANGES_WINDOW = SEC_PER_HOUR;
+static int	CONFIG_FLEET_SAMPLES = 120;
+static char	*CONFIG_EXPORT_DIR = NULL;
+static char	**CONFIG_SERVICES = NULL;
+
 int	zbx_module_cloud_discovery(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_monitor(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_list(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_export(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_status(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_state_age(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_state_changes(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_by_addr(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_by_name(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_owner_id(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_image_id(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_image_href(AGENT_REQUEST *request, AGENT_RESULT *result);
@@ -53,11 +102,44 @@ int	zbx_module_cloud_instance_launch_time(AGENT_REQUEST *request, AGENT_RESULT *
 int	zbx_module_cloud_instance_hwp_href(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_hwp_id(AGENT_REQUEST *request, AGENT_RESULT *result);
 int	zbx_module_cloud_instance_hwp_name(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_hwp_cpu(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_hwp_memory(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_hwp_storage(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_hwp_architecture(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_proxy(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_cache_check(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_cache_stress(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_cache_compact(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_image_list(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_image_get(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_realm_list(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_realm_get(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_hwp_list(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_hwp_get(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_volume_list(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_volume_get(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_service_memory(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_fleet_trend(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_image_name(AGENT_REQUEST *request, AGENT_RESULT *result);
+int	zbx_module_cloud_instance_realm_name(AGENT_REQUEST *request, AGENT_RESULT *result);
 
 static zbx_mem_info_t   *cloud_mem = NULL;
+static int		cloud_semid = -1;
 
 ZBX_MEM_FUNC_IMPL(__cloud, cloud_mem);
 
+/* chunk layout of the zbx_mem allocator (memalloc.c):                 */
+/* <size> <prev free chunk> <next free chunk> ... <size> if it is free, */
+/* <size> <allocated memory> ... <size> if it is used                   */
+#define CLOUD_MEM_BUCKET_COUNT	30
+#define CLOUD_MEM_MIN_ALLOC	24
+#define CLOUD_MEM_FLG_USED	((__UINT64_C(1)) << 63)
+#define CLOUD_MEM_CHUNK_SIZE(chunk)	(*(zbx_uint64_t *)(chunk) & ~CLOUD_MEM_FLG_USED)
+#define CLOUD_MEM_CHUNK_NEXT(chunk)	(*(void **)((char *)(chunk) + sizeof(zbx_uint64_t) + ZBX_PTR_SIZE))
+
+/* size of the chunk allocated for the requested size, as counted in used_size */
+#define CLOUD_MEM_ALLOC_SIZE(size)	MAX(CLOUD_MEM_MIN_ALLOC, ((zbx_uint64_t)(size) + 7) & ~(zbx_uint64_t)7)
+
 //////
 
 
@@ -67,6 +149,76 @@ typedef struct
 }
 zbx_deltacloud_t;
 
+/* collections of a service cached besides instances */
+#define CLOUD_COLLECTION_IMAGES			0
+#define CLOUD_COLLECTION_REALMS			1
+#define CLOUD_COLLECTION_HARDWARE_PROFILES	2
+#define CLOUD_COLLECTION_STORAGE_VOLUMES	3
+#define CLOUD_COLLECTION_COUNT			4
+
+#define CLOUD_RESOURCE_FIELDS_MAX	10
+#define CLOUD_COLLECTION_INIT_SIZE	16
+
+/* item of a collection, values are in the order of the collection fields */
+typedef struct
+{
+	char	*values[CLOUD_RESOURCE_FIELDS_MAX];	/* values[0] is the id, the resource is indexed by it */
+}
+zbx_deltacloud_resource_t;
+
+typedef struct
+{
+	const char	*name;		/* used in item keys and messages */
+	const char	*macro;		/* LLD macro prefix */
+	const char	*fields[CLOUD_RESOURCE_FIELDS_MAX + 1];
+}
+zbx_cloud_collection_t;
+
+static const zbx_cloud_collection_t	cloud_collections[CLOUD_COLLECTION_COUNT] =
+{
+	{"image",	"IMAGE",	{"id", "href", "name", "description", "architecture", "owner_id", "state", NULL}},
+	{"realm",	"REALM",	{"id", "href", "name", "limit", "state", NULL}},
+	{"hwp",		"HWP",		{"id", "href", "name", "cpu", "memory", "storage", "architecture", NULL}},
+	{"volume",	"VOLUME",	{"id", "href", "name", "created", "state", "capacity", "device", "realm_id",
+					"instance_id", "device_name", NULL}}
+};
+
+/* instance states counted by the fleet samples, any other state is counted as "other" */
+#define CLOUD_FLEET_PENDING		0
+#define CLOUD_FLEET_RUNNING		1
+#define CLOUD_FLEET_STOPPED		2
+#define CLOUD_FLEET_SHUTTING_DOWN	3
+#define CLOUD_FLEET_OTHER		4
+#define CLOUD_FLEET_STATE_COUNT		5
+
+/* values of a fleet sample returned by cloud.fleet.trend, the states come first */
+#define CLOUD_FLEET_TOTAL		CLOUD_FLEET_STATE_COUNT
+#define CLOUD_FLEET_DURATION		(CLOUD_FLEET_STATE_COUNT + 1)
+
+static const char	*cloud_fleet_values[] = {"pending", "running", "stopped", "shutting_down", "other", "total",
+		"duration", NULL};
+
+/* instances of a service seen by one refresh */
+typedef struct
+{
+	int	clock;
+	int	total;
+	int	states[CLOUD_FLEET_STATE_COUNT];
+	double	duration;	/* seconds the refresh took */
+}
+zbx_cloud_fleet_sample_t;
+
+/* entry of the instance indexes of a service */
+typedef struct
+{
+	const char	*key;	/* the name or an address of the instance, owned by the instance */
+	int		index;	/* index in service->instances */
+}
+zbx_cloud_instance_ref_t;
+
+/* index size for the number of keys, large enough to be never grown by the inserts */
+#define CLOUD_INDEX_INIT_SIZE(keys)	MAX((keys) * 5 / 4 + 1, CLOUD_COLLECTION_INIT_SIZE)
+
 typedef struct
 {
 	char    *url;
@@ -74,28 +226,78 @@ typedef struct
         char    *secret;
         char    *driver;
         char    *provider;
-        int	lastcheck;
+        int	lastcheck;	/* time of the last refresh, 0 if never refreshed */
+        zbx_uint64_t	generation;	/* incremented before and after every change of instances, */
+        				/* odd while the change is in progress                     */
+        zbx_uint64_t	hot_generation;	/* incremented after every change of the data read by local */
+        				/* views, cold attributes and compactions do not change it   */
         int	lastaccess;
+        int	failures;	/* consecutive failed refreshes */
+        int	probe_time;	/* when the open circuit breaker lets the next refresh through */
+        int	cold_demand;	/* last time a cold instance field was read, 0 if never */
+        zbx_uint64_t	mem_used;	/* bytes of the shared cache owned by the service */
+        zbx_uint64_t	mem_limit;	/* MemoryLimit of the service, 0 to use ServiceMemoryLimit */
+        zbx_uint64_t	mem_overflows;	/* refreshes discarded because of the memory limit */
         zbx_vector_ptr_t  instances;
+        zbx_vector_ptr_t  hardware_profiles;
+        zbx_hashset_t	collections[CLOUD_COLLECTION_COUNT];	/* zbx_deltacloud_resource_t indexed by id */
+        zbx_hashset_t	id_index;	/* zbx_cloud_instance_ref_t by instance id, rebuilt with the instances */
+        zbx_hashset_t	name_index;	/* zbx_cloud_instance_ref_t by instance name */
+        zbx_hashset_t	addr_index;	/* zbx_cloud_instance_ref_t by public and private instance address */
+        zbx_cloud_fleet_sample_t	*fleet;	/* ring buffer of the last refreshes, NULL until the first one */
+        int	fleet_size;	/* number of allocated samples */
+        int	fleet_num;	/* number of valid samples */
+        int	fleet_next;	/* where the next sample is stored */
 }
 zbx_deltacloud_service_t;
 
+/* hardware profile shared by every instance of a service which runs on it, */
+/* properties are parsed into numbers once per refresh                      */
+typedef struct
+{
+	char		*href;
+	char		*id;
+	char		*name;
+	char		*architecture;
+	double		cpu;
+	zbx_uint64_t	memory;		/* in bytes */
+	zbx_uint64_t	storage;	/* in bytes */
+}
+zbx_deltacloud_hardware_profile_t;
 
-typedef struct deltacloud_hardware_profile zbx_deltacloud_hardware_profile_t;
-
+/* rarely read instance attributes, stored only while items ask for them, see cloud_instance_cold_get() */
 typedef struct
 {
 	char *href;
+	char *owner_id;
+	char *image_href;
+	char *realm_href;
+	char *launch_time;
+}
+zbx_deltacloud_instance_cold_t;
+
+#define CLOUD_STATE_CHANGES_MAX	16
+
+/* state history of an instance, carried over from the previous instances by every refresh */
+typedef struct
+{
+	int	since;		/* when the instance entered its state or was first seen in it */
+	int	changes[CLOUD_STATE_CHANGES_MAX];	/* times of the last state changes, a ring buffer */
+	int	changes_num;	/* number of valid times in changes */
+	int	changes_next;	/* where the next change is stored */
+}
+zbx_cloud_state_history_t;
+
+typedef struct
+{
 	char *id;
 	char *name;
-	char *owner_id;
 	char *image_id;
-	char *image_href;
 	char *realm_id;
-	char *realm_href;
 	char *state;
-	char *launch_time;
-	zbx_deltacloud_hardware_profile_t *hwp;
+	int hwp_index;	/* index in service->hardware_profiles, -1 if none */
+	zbx_deltacloud_instance_cold_t *cold;	/* NULL if cold attributes are not stored */
+	zbx_cloud_state_history_t history;
 	zbx_vector_ptr_t public_addresses;
 	zbx_vector_ptr_t private_addresses;
 }
@@ -106,6 +308,14 @@ typedef struct deltacloud_address zbx_deltacloud_address_t;
 static zbx_deltacloud_t	*deltacloud = NULL; 
 static void     cloud_service_shared_free(zbx_deltacloud_service_t *service);
 static void	cloud_instance_shared_free(zbx_deltacloud_instance_t *instance);
+static void	cloud_hardware_profile_shared_free(zbx_deltacloud_hardware_profile_t *hwp);
+static void	cloud_service_clear(zbx_deltacloud_service_t *service, zbx_mem_free_func_t free_func);
+static void	cloud_cache_compact(void);
+static void	cloud_cache_compact_auto(void);
+static int	cloud_service_breaker_allow(zbx_deltacloud_service_t *service, int now);
+static void	cloud_service_breaker_update(zbx_deltacloud_service_t *service, int ret, int now);
+static int	cloud_service_refresh(zbx_deltacloud_service_t *service, char *url, char *key, char *secret, char *driver,
+		char *provider);
 
 #define CLOUD_VECTOR_CREATE(ref, type) zbx_vector_##type##_create_ext(ref, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func)
 
@@ -116,7 +326,12 @@ static ZBX_METRIC keys[] =
 {
 	{"cloud.monitor",	CF_HAVEPARAMS,	zbx_module_cloud_monitor,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
 	{"cloud.instance.list",	CF_HAVEPARAMS,	zbx_module_cloud_instance_list,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
+	{"cloud.instance.export",	CF_HAVEPARAMS,	zbx_module_cloud_instance_export,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,instances.json"},
 	{"cloud.instance.status",	CF_HAVEPARAMS,	zbx_module_cloud_instance_status,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.state_age",	CF_HAVEPARAMS,	zbx_module_cloud_instance_state_age,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.state_changes",	CF_HAVEPARAMS,	zbx_module_cloud_instance_state_changes,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.by_addr",	CF_HAVEPARAMS,	zbx_module_cloud_instance_by_addr,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,10.0.0.5"},
+	{"cloud.instance.by_name",	CF_HAVEPARAMS,	zbx_module_cloud_instance_by_name,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,instance_name"},
 	{"cloud.instance.owner_id",	CF_HAVEPARAMS,	zbx_module_cloud_instance_owner_id,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
 	{"cloud.instance.image_id",	CF_HAVEPARAMS,	zbx_module_cloud_instance_image_id,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
 	{"cloud.instance.image_href",	CF_HAVEPARAMS,	zbx_module_cloud_instance_image_href,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
@@ -126,6 +341,25 @@ static ZBX_METRIC keys[] =
 	{"cloud.instance.hwp.href",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_href,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
 	{"cloud.instance.hwp.id",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_id,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
 	{"cloud.instance.hwp.name",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_name,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.hwp.cpu",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_cpu,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.hwp.memory",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_memory,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.hwp.storage",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_storage,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.hwp.architecture",	CF_HAVEPARAMS,	zbx_module_cloud_instance_hwp_architecture,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.image_name",	CF_HAVEPARAMS,	zbx_module_cloud_instance_image_name,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.instance.realm_name",	CF_HAVEPARAMS,	zbx_module_cloud_instance_realm_name,"http://hostname/api,ABC1223DE,ZDADQWQ2133, instance_id"},
+	{"cloud.image.list",	CF_HAVEPARAMS,	zbx_module_cloud_image_list,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
+	{"cloud.image.get",	CF_HAVEPARAMS,	zbx_module_cloud_image_get,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,image_id,name"},
+	{"cloud.realm.list",	CF_HAVEPARAMS,	zbx_module_cloud_realm_list,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
+	{"cloud.realm.get",	CF_HAVEPARAMS,	zbx_module_cloud_realm_get,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,realm_id,name"},
+	{"cloud.hwp.list",	CF_HAVEPARAMS,	zbx_module_cloud_hwp_list,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
+	{"cloud.hwp.get",	CF_HAVEPARAMS,	zbx_module_cloud_hwp_get,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,hwp_id,memory"},
+	{"cloud.volume.list",	CF_HAVEPARAMS,	zbx_module_cloud_volume_list,"http://hostname/api,ABC1223DE,ZDADQWQ2133"},
+	{"cloud.volume.get",	CF_HAVEPARAMS,	zbx_module_cloud_volume_get,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,volume_id,state"},
+	{"cloud.service.memory",	CF_HAVEPARAMS,	zbx_module_cloud_service_memory,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,used"},
+	{"cloud.fleet.trend",	CF_HAVEPARAMS,	zbx_module_cloud_fleet_trend,"http://hostname/api,ABC1223DE,ZDADQWQ2133,,,running,1h,avg"},
+	{"cloud.cache.check",	0,		zbx_module_cloud_cache_check,	NULL},
+	{"cloud.cache.stress",	CF_HAVEPARAMS,	zbx_module_cloud_cache_stress,	"4,1,1,100"},
+	{"cloud.cache.compact",	0,		zbx_module_cloud_cache_compact,	NULL},
 	{NULL}
 };
 
@@ -167,13 +401,99 @@ void	zbx_module_item_timeout(int timeout)
  * Return value: list of item keys                                            *
  *                                                                            *
  ******************************************************************************/
+static ZBX_METRIC	*client_keys = NULL;
+
 ZBX_METRIC	*zbx_module_item_list()
 {
+	if (NULL != client_keys)
+		return client_keys;
+
 	return keys;
 }
 
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_lock                                                       *
+ *                                                                            *
+ * Purpose: serialize access to the cache between agent processes             *
+ *                                                                            *
+ * Comment: SEM_UNDO releases the lock if a process dies while holding it     *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_lock(void)
+{
+	struct sembuf	op = {0, -1, SEM_UNDO};
 
-static char	*cloud_shared_strdup(const char *source)
+	while (-1 == semop(cloud_semid, &op, 1))
+	{
+		if (EINTR != errno)
+		{
+			zabbix_log(LOG_LEVEL_CRIT, "cannot lock cloud cache: %s", zbx_strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void	cloud_unlock(void)
+{
+	struct sembuf	op = {0, 1, SEM_UNDO};
+
+	while (-1 == semop(cloud_semid, &op, 1))
+	{
+		if (EINTR != errno)
+		{
+			zabbix_log(LOG_LEVEL_CRIT, "cannot unlock cloud cache: %s", zbx_strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_sigchld_block                                              *
+ *                                                                            *
+ * Purpose: keep SIGCHLD of module children from the agent handler            *
+ *                                                                            *
+ * Parameters: orig_mask - [OUT] signal mask to restore                       *
+ *                                                                            *
+ * Comment: agent processes exit on SIGCHLD of their own children, so it must *
+ *          be blocked before forking and consumed by cloud_sigchld_unblock() *
+ *          after the children were reaped                                    *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_sigchld_block(sigset_t *orig_mask)
+{
+	sigset_t	mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, orig_mask);
+}
+
+static void	cloud_sigchld_unblock(const sigset_t *orig_mask)
+{
+	sigset_t	mask;
+	struct timespec	ts = {0, 0};
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	/* the signal is consumed only if the caller did not block it before */
+	if (0 == sigismember(orig_mask, SIGCHLD))
+		sigtimedwait(&mask, NULL, &ts);
+
+	sigprocmask(SIG_SETMASK, orig_mask, NULL);
+}
+
+/* restore the default SIGCHLD handling in a forked module child */
+static void	cloud_sigchld_child(const sigset_t *orig_mask)
+{
+	signal(SIGCHLD, SIG_DFL);
+	sigprocmask(SIG_SETMASK, orig_mask, NULL);
+}
+
+
+static char	*cloud_strdup_ext(const char *source, zbx_mem_malloc_func_t malloc_func)
 {
 	char	*ptr = NULL;
 	size_t	len;
@@ -181,707 +501,5386 @@ static char	*cloud_shared_strdup(const char *source)
 	if (NULL != source)
 	{
 		len = strlen(source) + 1;
-		ptr = __cloud_mem_malloc_func(NULL, len);
+		ptr = malloc_func(NULL, len);
 		memcpy(ptr, source, len);
 	}
 
 	return ptr;
 }
 
-static zbx_deltacloud_hardware_profile_t *cloud_hardware_profile_shared_dup(const struct deltacloud_hardware_profile *src)
+static char	*cloud_shared_strdup(const char *source)
 {
-	zbx_deltacloud_hardware_profile_t	*hardware_profile;
-	hardware_profile = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_hardware_profile_t));
-	
-	hardware_profile->href = cloud_shared_strdup(src->href);
-	hardware_profile->id = cloud_shared_strdup(src->id);
-	hardware_profile->name = cloud_shared_strdup(src->name);
-	return hardware_profile;
+	return cloud_strdup_ext(source, __cloud_mem_malloc_func);
 }
-	
 
-zbx_deltacloud_service_t	*zbx_deltacloud_get_service(const char* url, const char* key, const char* secret, const char* driver, const char* provider)
+static zbx_deltacloud_instance_cold_t	*cloud_instance_cold_copy(const zbx_deltacloud_instance_cold_t *cold,
+		zbx_mem_malloc_func_t malloc_func)
 {
-	int i;
-	zbx_deltacloud_service_t	*service = NULL;
+	zbx_deltacloud_instance_cold_t	*cold_copy;
 
-	if (NULL == deltacloud)
-	{
-		zabbix_log(LOG_LEVEL_ERR, "---Not initialized shared memory---");
+	if (NULL == cold)
 		return NULL;
+
+	cold_copy = malloc_func(NULL, sizeof(zbx_deltacloud_instance_cold_t));
+	cold_copy->href = cloud_strdup_ext(cold->href, malloc_func);
+	cold_copy->owner_id = cloud_strdup_ext(cold->owner_id, malloc_func);
+	cold_copy->image_href = cloud_strdup_ext(cold->image_href, malloc_func);
+	cold_copy->realm_href = cloud_strdup_ext(cold->realm_href, malloc_func);
+	cold_copy->launch_time = cloud_strdup_ext(cold->launch_time, malloc_func);
+
+	return cold_copy;
+}
+
+static zbx_hash_t	cloud_resource_hash(const void *data)
+{
+	const zbx_deltacloud_resource_t	*resource = (const zbx_deltacloud_resource_t *)data;
+
+	return ZBX_DEFAULT_STRING_HASH_ALGO(resource->values[0], strlen(resource->values[0]), ZBX_DEFAULT_HASH_SEED);
+}
+
+static int	cloud_resource_compare(const void *d1, const void *d2)
+{
+	const zbx_deltacloud_resource_t	*r1 = (const zbx_deltacloud_resource_t *)d1;
+	const zbx_deltacloud_resource_t	*r2 = (const zbx_deltacloud_resource_t *)d2;
+
+	return strcmp(r1->values[0], r2->values[0]);
+}
+
+static void	cloud_resource_clear(zbx_deltacloud_resource_t *resource, zbx_mem_free_func_t free_func)
+{
+	int	i;
+
+	for (i = 0; i < CLOUD_RESOURCE_FIELDS_MAX; i++)
+	{
+		if (NULL != resource->values[i])
+			free_func(resource->values[i]);
 	}
+}
 
-	for (i = 0; i < deltacloud->services.values_num; i++)
+static void	cloud_resources_copy(zbx_hashset_t *dst, zbx_hashset_t *src, zbx_mem_malloc_func_t malloc_func,
+		zbx_mem_realloc_func_t realloc_func, zbx_mem_free_func_t free_func)
+{
+	int				i;
+	zbx_hashset_iter_t		iter;
+	zbx_deltacloud_resource_t	*resource, copy;
+
+	zbx_hashset_create_ext(dst, CLOUD_INDEX_INIT_SIZE(src->num_data), cloud_resource_hash, cloud_resource_compare,
+			malloc_func, realloc_func, free_func);
+
+	zbx_hashset_iter_reset(src, &iter);
+
+	while (NULL != (resource = zbx_hashset_iter_next(&iter)))
 	{
-		service = deltacloud->services.values[i];
-		if (0 == strcmp(service->url, url) && 0 == strcmp(service->key, key) && 0 == strcmp(service->secret, secret) && 0 == strcmp(service->driver, driver) && 0 == strcmp(service->provider, provider))
-		{
-			return service;
-		}
+		for (i = 0; i < CLOUD_RESOURCE_FIELDS_MAX; i++)
+			copy.values[i] = cloud_strdup_ext(resource->values[i], malloc_func);
+
+		zbx_hashset_insert(dst, &copy, sizeof(copy));
 	}
+}
 
-	service = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_service_t));
+static void	cloud_resources_clear(zbx_hashset_t *resources, zbx_mem_free_func_t free_func)
+{
+	zbx_hashset_iter_t		iter;
+	zbx_deltacloud_resource_t	*resource;
 
-	memset(service, 0, sizeof(zbx_deltacloud_service_t));
+	zbx_hashset_iter_reset(resources, &iter);
 
-	service->url = cloud_shared_strdup(url);
-	service->key = cloud_shared_strdup(key);
-	service->secret = cloud_shared_strdup(secret);
-	service->driver = cloud_shared_strdup(driver);
-	service->provider = cloud_shared_strdup(provider);
-	service->lastaccess = time(NULL);
-	service->lastcheck = time(NULL);
-	CLOUD_VECTOR_CREATE(&service->instances, ptr);
+	while (NULL != (resource = zbx_hashset_iter_next(&iter)))
+		cloud_resource_clear(resource, free_func);
 
-	zbx_vector_ptr_append(&deltacloud->services, service);
-	return service;
+	zbx_hashset_destroy(resources);
+}
+
+static zbx_deltacloud_resource_t	*cloud_resource_find(zbx_deltacloud_service_t *service, int collection,
+		const char *id)
+{
+	zbx_deltacloud_resource_t	resource_local;
+
+	if (NULL == id)
+		return NULL;
+
+	memset(&resource_local, 0, sizeof(resource_local));
+	resource_local.values[0] = (char *)id;
+
+	return zbx_hashset_search(&service->collections[collection], &resource_local);
+}
+
+static zbx_hash_t	cloud_instance_ref_hash(const void *data)
+{
+	const zbx_cloud_instance_ref_t	*ref = (const zbx_cloud_instance_ref_t *)data;
+
+	return ZBX_DEFAULT_STRING_HASH_ALGO(ref->key, strlen(ref->key), ZBX_DEFAULT_HASH_SEED);
+}
+
+static int	cloud_instance_ref_compare(const void *d1, const void *d2)
+{
+	const zbx_cloud_instance_ref_t	*r1 = (const zbx_cloud_instance_ref_t *)d1;
+	const zbx_cloud_instance_ref_t	*r2 = (const zbx_cloud_instance_ref_t *)d2;
+
+	return strcmp(r1->key, r2->key);
+}
+
+static void	cloud_instance_ref_add(zbx_hashset_t *index, const char *key, int instance_index)
+{
+	zbx_cloud_instance_ref_t	ref;
+
+	if (NULL == key)
+		return;
+
+	/* instances sharing a name or an address are found by the first one */
+	ref.key = key;
+	ref.index = instance_index;
+	zbx_hashset_insert(index, &ref, sizeof(ref));
+}
+
+/* number of public and private addresses of the cached instances */
+static int	cloud_instances_addresses_num(const zbx_vector_ptr_t *instances)
+{
+	int				i, addresses_num = 0;
+	const zbx_deltacloud_instance_t	*instance;
+
+	for (i = 0; i < instances->values_num; i++)
+	{
+		instance = instances->values[i];
+		addresses_num += instance->public_addresses.values_num + instance->private_addresses.values_num;
+	}
+
+	return addresses_num;
 }
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_cloud_instance_list                                   *
- *                                                                            *
- * Purpose: Discovering cloud instances list from deltacloud                  *
- *                                                                            *
- * Parameters: request - structure that contains item key and parameters      *
- *              request->key - item key without parameters                    *
- *              request->nparam - number of parameters                        *
- *              request->timeout - processing should not take longer than     *
- *                                 this number of seconds                     *
- *              request->params[N-1] - pointers to item key parameters        *
- *                                                                            *
- *             result - structure that will contain result                    *
+ * Function: cloud_instances_index                                            *
  *                                                                            *
- * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
- *                                 as not supported by zabbix                 *
- *               SYSINFO_RET_OK - success                                     *
+ * Purpose: create the id, name and address indexes of the service instances  *
  *                                                                            *
- * Comment: get_rparam(request, N-1) can be used to get a pointer to the Nth  *
- *          parameter starting from 0 (first parameter). Make sure it exists  *
- *          by checking value of request->nparam.                             *
+ * Comment: the indexes refer to instances by their position and to keys     *
+ *          owned by the instances, so they are created again whenever the    *
+ *          instances are replaced or copied                                  *
  *                                                                            *
  ******************************************************************************/
-int	zbx_module_cloud_instance_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+static void	cloud_instances_index(zbx_deltacloud_service_t *service, zbx_mem_malloc_func_t malloc_func,
+		zbx_mem_realloc_func_t realloc_func, zbx_mem_free_func_t free_func)
 {
-	int i,j;
-	struct zbx_json json;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	zbx_deltacloud_service_t	*service = NULL;
+	int				i, j;
+	const zbx_deltacloud_instance_t	*instance;
 
-	if (request->nparam != 5)
+	zbx_hashset_create_ext(&service->id_index, CLOUD_INDEX_INIT_SIZE(service->instances.values_num),
+			cloud_instance_ref_hash, cloud_instance_ref_compare, malloc_func, realloc_func, free_func);
+	zbx_hashset_create_ext(&service->name_index, CLOUD_INDEX_INIT_SIZE(service->instances.values_num),
+			cloud_instance_ref_hash, cloud_instance_ref_compare, malloc_func, realloc_func, free_func);
+	zbx_hashset_create_ext(&service->addr_index,
+			CLOUD_INDEX_INIT_SIZE(cloud_instances_addresses_num(&service->instances)),
+			cloud_instance_ref_hash, cloud_instance_ref_compare, malloc_func, realloc_func, free_func);
+
+	for (i = 0; i < service->instances.values_num; i++)
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instance.list[url, key, secret, driver, provider]"));
-		return SYSINFO_RET_FAIL;
-	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
+		instance = service->instances.values[i];
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+		cloud_instance_ref_add(&service->id_index, instance->id, i);
+		cloud_instance_ref_add(&service->name_index, instance->name, i);
 
-	if(&service->instances==NULL){
-		SET_MSG_RESULT(result, strdup("No instances"));
-		return SYSINFO_RET_OK;
-	}
-	
-	// json format init
-	zbx_json_init(&json, ZBX_JSON_STAT_BUF_LEN);
-	// Add "data":[] for LLD format
-	zbx_json_addarray(&json, ZBX_PROTO_TAG_DATA);
-	for (i = 0; service->instances.values_num; i++)
-	{
-		//deltacloud_instance = NULL;
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (NULL == instance)
-		{
-			zbx_json_close(&json);
-			break;
-		}
-		zbx_json_addobject(&json, NULL);
-		if (NULL != instance->name)
-			zbx_json_addstring(&json, NAME_MACRO, instance->name, ZBX_JSON_TYPE_STRING);
-		if (NULL != instance->id)
-			zbx_json_addstring(&json, ID_MACRO, instance->id, ZBX_JSON_TYPE_STRING);
-		for (j = 0; instance->public_addresses.values_num; j++)
+		for (j = 0; j < instance->public_addresses.values_num; j++)
 		{
-			zbx_deltacloud_address_t *address = instance->public_addresses.values[j];
-			zbx_json_addstring(&json, PUBLIC_ADDR_MACRO, address->address, ZBX_JSON_TYPE_STRING);
-			break; /* ToDo: multi address support */
+			cloud_instance_ref_add(&service->addr_index,
+					((zbx_deltacloud_address_t *)instance->public_addresses.values[j])->address, i);
 		}
-		
-		for (j = 0; instance->private_addresses.values_num; j++)
+
+		for (j = 0; j < instance->private_addresses.values_num; j++)
 		{
-			zbx_deltacloud_address_t *address = instance->private_addresses.values[j];
-			zbx_json_addstring(&json, PRIVATE_ADDR_MACRO, address->address, ZBX_JSON_TYPE_STRING);
-			break; /* ToDo: multi address support */
+			cloud_instance_ref_add(&service->addr_index,
+					((zbx_deltacloud_address_t *)instance->private_addresses.values[j])->address, i);
 		}
-		zbx_json_close(&json);
 	}
-
-	SET_STR_RESULT(result, strdup(json.buffer));
-	zbx_json_free(&json);
-	
-	return SYSINFO_RET_OK;
 }
-	
-int	zbx_module_cloud_monitor(AGENT_REQUEST *request, AGENT_RESULT *result)
+
+static zbx_deltacloud_instance_t	*cloud_instance_index_find(const zbx_deltacloud_service_t *service,
+		const zbx_hashset_t *index, const char *key)
 {
-	int i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
-	zbx_deltacloud_address_t	*public_address = NULL;
-	zbx_deltacloud_address_t	*private_address = NULL;
-	struct deltacloud_api api;
-	struct deltacloud_instance *instance = NULL;
+	zbx_cloud_instance_ref_t	ref_local, *ref;
+
+	ref_local.key = key;
+
+	if (NULL == (ref = zbx_hashset_search((zbx_hashset_t *)index, &ref_local)))
+		return NULL;
+
+	return service->instances.values[ref->index];
+}
+
+static void	cloud_addresses_copy(zbx_vector_ptr_t *dst, const zbx_vector_ptr_t *src, zbx_mem_malloc_func_t malloc_func,
+		zbx_mem_realloc_func_t realloc_func, zbx_mem_free_func_t free_func)
+{
+	int				i;
+	zbx_deltacloud_address_t	*address;
+
+	zbx_vector_ptr_create_ext(dst, malloc_func, realloc_func, free_func);
+
+	if (0 == src->values_num)
+		return;
+
+	zbx_vector_ptr_reserve(dst, src->values_num);
+
+	for (i = 0; i < src->values_num; i++)
+	{
+		address = malloc_func(NULL, sizeof(zbx_deltacloud_address_t));
+		address->address = cloud_strdup_ext(((zbx_deltacloud_address_t *)src->values[i])->address, malloc_func);
+		zbx_vector_ptr_append(dst, address);
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_copy                                               *
+ *                                                                            *
+ * Purpose: deep copy everything the service owns using the given allocator   *
+ *                                                                            *
+ * Parameters: dst - the service to copy to, its previous contents must be    *
+ *                   already freed                                            *
+ *             src - the service to copy from                                 *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_service_copy(zbx_deltacloud_service_t *dst, const zbx_deltacloud_service_t *src,
+		zbx_mem_malloc_func_t malloc_func, zbx_mem_realloc_func_t realloc_func, zbx_mem_free_func_t free_func)
+{
+	int					i;
+	const zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_instance_t		*instance_copy;
+	const zbx_deltacloud_hardware_profile_t	*hwp;
+	zbx_deltacloud_hardware_profile_t	*hwp_copy;
+
+	*dst = *src;
+
+	dst->url = cloud_strdup_ext(src->url, malloc_func);
+	dst->key = cloud_strdup_ext(src->key, malloc_func);
+	dst->secret = cloud_strdup_ext(src->secret, malloc_func);
+	dst->driver = cloud_strdup_ext(src->driver, malloc_func);
+	dst->provider = cloud_strdup_ext(src->provider, malloc_func);
+
+	if (NULL != src->fleet)
+	{
+		dst->fleet = malloc_func(NULL, src->fleet_size * sizeof(zbx_cloud_fleet_sample_t));
+		memcpy(dst->fleet, src->fleet, src->fleet_size * sizeof(zbx_cloud_fleet_sample_t));
+	}
+
+	zbx_vector_ptr_create_ext(&dst->hardware_profiles, malloc_func, realloc_func, free_func);
+
+	if (0 != src->hardware_profiles.values_num)
+		zbx_vector_ptr_reserve(&dst->hardware_profiles, src->hardware_profiles.values_num);
+
+	for (i = 0; i < src->hardware_profiles.values_num; i++)
+	{
+		hwp = src->hardware_profiles.values[i];
+		hwp_copy = malloc_func(NULL, sizeof(zbx_deltacloud_hardware_profile_t));
+		*hwp_copy = *hwp;
+		hwp_copy->href = cloud_strdup_ext(hwp->href, malloc_func);
+		hwp_copy->id = cloud_strdup_ext(hwp->id, malloc_func);
+		hwp_copy->name = cloud_strdup_ext(hwp->name, malloc_func);
+		hwp_copy->architecture = cloud_strdup_ext(hwp->architecture, malloc_func);
+		zbx_vector_ptr_append(&dst->hardware_profiles, hwp_copy);
+	}
+
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+	{
+		cloud_resources_copy(&dst->collections[i], (zbx_hashset_t *)&src->collections[i], malloc_func,
+				realloc_func, free_func);
+	}
+
+	zbx_vector_ptr_create_ext(&dst->instances, malloc_func, realloc_func, free_func);
+
+	if (0 != src->instances.values_num)
+		zbx_vector_ptr_reserve(&dst->instances, src->instances.values_num);
+
+	for (i = 0; i < src->instances.values_num; i++)
+	{
+		instance = src->instances.values[i];
+		instance_copy = malloc_func(NULL, sizeof(zbx_deltacloud_instance_t));
+		*instance_copy = *instance;
+		instance_copy->id = cloud_strdup_ext(instance->id, malloc_func);
+		instance_copy->name = cloud_strdup_ext(instance->name, malloc_func);
+		instance_copy->image_id = cloud_strdup_ext(instance->image_id, malloc_func);
+		instance_copy->realm_id = cloud_strdup_ext(instance->realm_id, malloc_func);
+		instance_copy->state = cloud_strdup_ext(instance->state, malloc_func);
+		instance_copy->cold = cloud_instance_cold_copy(instance->cold, malloc_func);
+		cloud_addresses_copy(&instance_copy->public_addresses, &instance->public_addresses, malloc_func,
+				realloc_func, free_func);
+		cloud_addresses_copy(&instance_copy->private_addresses, &instance->private_addresses, malloc_func,
+				realloc_func, free_func);
+		zbx_vector_ptr_append(&dst->instances, instance_copy);
+	}
+
+	cloud_instances_index(dst, malloc_func, realloc_func, free_func);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_size                                                       *
+ *                                                                            *
+ * Purpose: convert size with unit to bytes                                   *
+ *                                                                            *
+ * Parameters: size - numeric value, for example "1740.8", may be NULL        *
+ *             unit - KB, MB, GB or TB, NULL or any other unit for bytes      *
+ *                                                                            *
+ * Return value: size in bytes, 0 if the value is missing, not numeric or     *
+ *               negative                                                     *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_uint64_t	cloud_size(const char *size, const char *unit)
+{
+	double	value;
+	char	*end;
+
+	if (NULL == size)
+		return 0;
+
+	value = strtod(size, &end);
+
+	if (end == size || 0 > value)
+		return 0;
+
+	if (NULL != unit)
+	{
+		if (0 == strcasecmp(unit, "KB"))
+			value *= ZBX_KIBIBYTE;
+		else if (0 == strcasecmp(unit, "MB"))
+			value *= ZBX_MEBIBYTE;
+		else if (0 == strcasecmp(unit, "GB"))
+			value *= ZBX_GIBIBYTE;
+		else if (0 == strcasecmp(unit, "TB"))
+			value *= ZBX_TEBIBYTE;
+	}
+
+	return (zbx_uint64_t)value;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_hardware_profile_size                                      *
+ *                                                                            *
+ * Purpose: convert hardware profile property value to bytes                  *
+ *                                                                            *
+ * Parameters: property - memory or storage property (value "1740.8",         *
+ *                        unit "MB")                                          *
+ *                                                                            *
+ * Return value: size in bytes, 0 if the value is not numeric                 *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_uint64_t	cloud_hardware_profile_size(const struct deltacloud_property *property)
+{
+	return cloud_size(property->value, property->unit);
+}
+
+static void	cloud_hardware_profile_parse(zbx_deltacloud_hardware_profile_t *hwp, const struct deltacloud_hardware_profile *src)
+{
+	const struct deltacloud_property	*property;
+
+	memset(hwp, 0, sizeof(zbx_deltacloud_hardware_profile_t));
+
+	hwp->href = src->href;
+	hwp->id = src->id;
+	hwp->name = src->name;
+
+	for (property = src->properties; NULL != property; property = property->next)
+	{
+		if (NULL == property->name || NULL == property->value)
+			continue;
+
+		if (0 == strcmp(property->name, "cpu"))
+			hwp->cpu = atof(property->value);
+		else if (0 == strcmp(property->name, "memory"))
+			hwp->memory = cloud_hardware_profile_size(property);
+		else if (0 == strcmp(property->name, "storage"))
+			hwp->storage = cloud_hardware_profile_size(property);
+		else if (0 == strcmp(property->name, "architecture"))
+			hwp->architecture = property->value;
+	}
+}
+
+static int	cloud_hardware_profile_equal(const zbx_deltacloud_hardware_profile_t *hwp1,
+		const zbx_deltacloud_hardware_profile_t *hwp2)
+{
+	if (0 == strcmp(hwp1->id, hwp2->id) && hwp1->cpu == hwp2->cpu && hwp1->memory == hwp2->memory &&
+			hwp1->storage == hwp2->storage && 0 == zbx_strcmp_null(hwp1->architecture, hwp2->architecture))
+	{
+		return SUCCEED;
+	}
+
+	return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_hardware_profile_shared_index                              *
+ *                                                                            *
+ * Purpose: find instance hardware profile in the service profile table,      *
+ *          adding it when it is not there yet                                *
+ *                                                                            *
+ * Return value: index in service->hardware_profiles, -1 if the instance has  *
+ *               no hardware profile                                          *
+ *                                                                            *
+ * Comment: profiles are equal when both id and parsed properties match, so   *
+ *          instances with customized sizes of the same profile are not       *
+ *          merged                                                            *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_hardware_profile_shared_index(zbx_deltacloud_service_t *service, const struct deltacloud_hardware_profile *src)
+{
+	int					i;
+	zbx_deltacloud_hardware_profile_t	parsed, *hwp;
+
+	if (NULL == src->id)
+		return -1;
+
+	cloud_hardware_profile_parse(&parsed, src);
+
+	for (i = 0; i < service->hardware_profiles.values_num; i++)
+	{
+		if (SUCCEED == cloud_hardware_profile_equal(service->hardware_profiles.values[i], &parsed))
+			return i;
+	}
+
+	hwp = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_hardware_profile_t));
+
+	hwp->href = cloud_shared_strdup(parsed.href);
+	hwp->id = cloud_shared_strdup(parsed.id);
+	hwp->name = cloud_shared_strdup(parsed.name);
+	hwp->architecture = cloud_shared_strdup(parsed.architecture);
+	hwp->cpu = parsed.cpu;
+	hwp->memory = parsed.memory;
+	hwp->storage = parsed.storage;
+
+	zbx_vector_ptr_append(&service->hardware_profiles, hwp);
+
+	return service->hardware_profiles.values_num - 1;
+}
+
+static zbx_deltacloud_hardware_profile_t	*cloud_instance_hardware_profile(const zbx_deltacloud_service_t *service,
+		const zbx_deltacloud_instance_t *instance)
+{
+	if (0 > instance->hwp_index || instance->hwp_index >= service->hardware_profiles.values_num)
+		return NULL;
+
+	return service->hardware_profiles.values[instance->hwp_index];
+}
+
+zbx_deltacloud_service_t	*zbx_deltacloud_get_service(const char* url, const char* key, const char* secret, const char* driver, const char* provider)
+{
+	int i;
+	zbx_deltacloud_service_t	*service = NULL;
+	zbx_uint64_t			used_size;
+
+	if (NULL == deltacloud)
+	{
+		zabbix_log(LOG_LEVEL_ERR, "---Not initialized shared memory---");
+		return NULL;
+	}
+
+	for (i = 0; i < deltacloud->services.values_num; i++)
+	{
+		service = deltacloud->services.values[i];
+		if (0 == strcmp(service->url, url) && 0 == strcmp(service->key, key) && 0 == strcmp(service->secret, secret) && 0 == strcmp(service->driver, driver) && 0 == strcmp(service->provider, provider))
+		{
+			return service;
+		}
+	}
+
+	used_size = cloud_mem->used_size;
+
+	service = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_service_t));
+
+	memset(service, 0, sizeof(zbx_deltacloud_service_t));
+
+	service->url = cloud_shared_strdup(url);
+	service->key = cloud_shared_strdup(key);
+	service->secret = cloud_shared_strdup(secret);
+	service->driver = cloud_shared_strdup(driver);
+	service->provider = cloud_shared_strdup(provider);
+	service->lastaccess = time(NULL);
+	service->lastcheck = 0;
+	CLOUD_VECTOR_CREATE(&service->instances, ptr);
+	CLOUD_VECTOR_CREATE(&service->hardware_profiles, ptr);
+
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+	{
+		zbx_hashset_create_ext(&service->collections[i], CLOUD_COLLECTION_INIT_SIZE, cloud_resource_hash, cloud_resource_compare,
+				__cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+	}
+
+	cloud_instances_index(service, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+
+	service->mem_used = cloud_mem->used_size - used_size;
+
+	zbx_vector_ptr_append(&deltacloud->services, service);
+	return service;
+}
+
+/* instance ids which were not found in the cached instances, kept by each process */
+typedef struct
+{
+	const zbx_deltacloud_service_t	*service;
+	zbx_uint64_t			generation;	/* service generation the id was missing in */
+	char				*id;
+}
+zbx_cloud_missing_id_t;
+
+#define CLOUD_MISSING_IDS_MAX	1024
+
+static zbx_hashset_t	cloud_missing_ids = {NULL};
+
+static zbx_hash_t	cloud_missing_id_hash(const void *data)
+{
+	const zbx_cloud_missing_id_t	*missing = (const zbx_cloud_missing_id_t *)data;
+	zbx_hash_t			hash;
+
+	hash = ZBX_DEFAULT_PTR_HASH_FUNC(&missing->service);
+
+	return ZBX_DEFAULT_STRING_HASH_ALGO(missing->id, strlen(missing->id), hash);
+}
+
+static int	cloud_missing_id_compare(const void *d1, const void *d2)
+{
+	const zbx_cloud_missing_id_t	*m1 = (const zbx_cloud_missing_id_t *)d1;
+	const zbx_cloud_missing_id_t	*m2 = (const zbx_cloud_missing_id_t *)d2;
+
+	if (m1->service != m2->service)
+		return m1->service < m2->service ? -1 : 1;
+
+	return strcmp(m1->id, m2->id);
+}
+
+static void	cloud_missing_ids_clear(void)
+{
+	zbx_hashset_iter_t	iter;
+	zbx_cloud_missing_id_t	*missing;
+
+	zbx_hashset_iter_reset(&cloud_missing_ids, &iter);
+
+	while (NULL != (missing = zbx_hashset_iter_next(&iter)))
+		zbx_free(missing->id);
+
+	zbx_hashset_clear(&cloud_missing_ids);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_missing_id_find                                            *
+ *                                                                            *
+ * Purpose: check if the id was already missing in the current instances of   *
+ *          the service                                                       *
+ *                                                                            *
+ * Return value: SUCCEED - the id is known to be missing                      *
+ *               FAIL - the id index must be searched                         *
+ *                                                                            *
+ * Comment: entries of previous generations are ignored, so that refreshed    *
+ *          instances are always searched again                               *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_missing_id_find(const zbx_deltacloud_service_t *service, const char *id)
+{
+	zbx_cloud_missing_id_t	missing_local, *missing;
+
+	if (NULL == cloud_missing_ids.slots)
+		return FAIL;
+
+	missing_local.service = service;
+	missing_local.id = (char *)id;
+
+	if (NULL == (missing = zbx_hashset_search(&cloud_missing_ids, &missing_local)))
+		return FAIL;
+
+	return missing->generation == service->generation ? SUCCEED : FAIL;
+}
+
+static void	cloud_missing_id_add(const zbx_deltacloud_service_t *service, const char *id)
+{
+	zbx_cloud_missing_id_t	missing_local, *missing;
+
+	if (NULL == cloud_missing_ids.slots)
+	{
+		zbx_hashset_create(&cloud_missing_ids, CLOUD_MISSING_IDS_MAX, cloud_missing_id_hash,
+				cloud_missing_id_compare);
+	}
+
+	/* ids of previous generations are dropped all at once instead of being expired one by one */
+	if (CLOUD_MISSING_IDS_MAX <= cloud_missing_ids.num_data)
+		cloud_missing_ids_clear();
+
+	missing_local.service = service;
+	missing_local.id = (char *)id;
+
+	missing = zbx_hashset_insert(&cloud_missing_ids, &missing_local, sizeof(missing_local));
+
+	if (missing->id == id)
+		missing->id = zbx_strdup(NULL, id);
+
+	missing->generation = service->generation;
+}
+
+/* private copy of a cached service kept by each process, see cloud_view_sync() */
+typedef struct
+{
+	char				*url;
+	char				*key;
+	char				*secret;
+	char				*driver;
+	char				*provider;
+	zbx_deltacloud_service_t	*shared;	/* the service in the shared cache */
+	zbx_deltacloud_service_t	service;	/* copy of the shared service in the process heap */
+	int				synced;		/* 0 until the first copy is made */
+}
+zbx_cloud_view_t;
+
+static zbx_vector_ptr_t	cloud_views = {NULL};
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_view_find                                                  *
+ *                                                                            *
+ * Purpose: find the local view of a service, registering the service in the  *
+ *          shared cache when it is not known yet                             *
+ *                                                                            *
+ * Comment: shared services are never moved, compaction keeps the service     *
+ *          structures in place, so the pointer is kept for the process       *
+ *          lifetime                                                          *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_cloud_view_t	*cloud_view_find(const char *url, const char *key, const char *secret, const char *driver,
+		const char *provider)
+{
+	int			i;
+	zbx_cloud_view_t	*view;
+
+	if (NULL == cloud_views.values)
+		zbx_vector_ptr_create(&cloud_views);
+
+	for (i = 0; i < cloud_views.values_num; i++)
+	{
+		view = cloud_views.values[i];
+
+		if (0 == strcmp(view->url, url) && 0 == strcmp(view->key, key) && 0 == strcmp(view->secret, secret) &&
+				0 == strcmp(view->driver, driver) && 0 == strcmp(view->provider, provider))
+		{
+			return view;
+		}
+	}
+
+	view = zbx_malloc(NULL, sizeof(zbx_cloud_view_t));
+	memset(view, 0, sizeof(zbx_cloud_view_t));
+
+	cloud_lock();
+	view->shared = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	cloud_unlock();
+
+	if (NULL == view->shared)
+	{
+		zbx_free(view);
+		return NULL;
+	}
+
+	view->url = zbx_strdup(NULL, url);
+	view->key = zbx_strdup(NULL, key);
+	view->secret = zbx_strdup(NULL, secret);
+	view->driver = zbx_strdup(NULL, driver);
+	view->provider = zbx_strdup(NULL, provider);
+
+	zbx_vector_ptr_append(&cloud_views, view);
+
+	return view;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_view_sync                                                  *
+ *                                                                            *
+ * Purpose: get the local copy of a service, copying the shared service again *
+ *          only when its hot generation has changed                          *
+ *                                                                            *
+ * Return value: the local copy, it must not be modified                      *
+ *                                                                            *
+ * Comment: while the hot generation is unchanged neither the lock is taken   *
+ *          nor the shared segment is read except the counter itself. Cold    *
+ *          attributes in the copy may be outdated, they are always read from *
+ *          the shared cache.                                                 *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_deltacloud_service_t	*cloud_view_sync(zbx_cloud_view_t *view)
+{
+	zbx_uint64_t	generation;
+
+	generation = *(volatile zbx_uint64_t *)&view->shared->hot_generation;
+
+	if (0 != view->synced && generation == view->service.hot_generation)
+		return &view->service;
+
+	cloud_lock();
+
+	if (0 != view->synced)
+		cloud_service_clear(&view->service, ZBX_DEFAULT_MEM_FREE_FUNC);
+
+	cloud_service_copy(&view->service, view->shared, ZBX_DEFAULT_MEM_MALLOC_FUNC, ZBX_DEFAULT_MEM_REALLOC_FUNC,
+			ZBX_DEFAULT_MEM_FREE_FUNC);
+	view->synced = 1;
+
+	cloud_unlock();
+
+	return &view->service;
+}
+
+static void	cloud_views_free(void)
+{
+	int			i;
+	zbx_cloud_view_t	*view;
+
+	if (NULL == cloud_views.values)
+		return;
+
+	for (i = 0; i < cloud_views.values_num; i++)
+	{
+		view = cloud_views.values[i];
+
+		if (0 != view->synced)
+			cloud_service_clear(&view->service, ZBX_DEFAULT_MEM_FREE_FUNC);
+
+		zbx_free(view->url);
+		zbx_free(view->key);
+		zbx_free(view->secret);
+		zbx_free(view->driver);
+		zbx_free(view->provider);
+		zbx_free(view);
+	}
+
+	zbx_vector_ptr_destroy(&cloud_views);
+}
+
+/* set when cloud_instance_get() returned with the cache locked */
+static int	cloud_instance_locked = 0;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_service_get                                       *
+ *                                                                            *
+ * Purpose: find the service of the instance items                            *
+ *          item[url, key, secret, driver, provider, ...]                     *
+ *                                                                            *
+ * Parameters: request    - item request                                      *
+ *             local_view - 1 to take the service from the local view         *
+ *                                                                            *
+ * Return value: the service or NULL if it is not cached                      *
+ *                                                                            *
+ * Comment: without local_view the shared cache stays locked,                 *
+ *          cloud_instance_release() must be called in both cases             *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_deltacloud_service_t	*cloud_instance_service_get(AGENT_REQUEST *request, int local_view)
+{
+	zbx_cloud_view_t	*view;
+
+	if (1 == local_view)
+	{
+		view = cloud_view_find(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+				get_rparam(request, 3), get_rparam(request, 4));
+
+		return NULL != view ? cloud_view_sync(view) : NULL;
+	}
+
+	cloud_lock();
+	cloud_instance_locked = 1;
+
+	return zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_get_ext                                           *
+ *                                                                            *
+ * Purpose: find cached instance requested by the instance attribute items    *
+ *          item[url, key, secret, driver, provider, instance_id]             *
+ *                                                                            *
+ * Parameters: request    - item request                                      *
+ *             result     - error message is set here on failure              *
+ *             service    - [OUT] the service instance belongs to             *
+ *             local_view - 1 to take the instance from the local view        *
+ *                                                                            *
+ * Return value: the instance or NULL if it was not found                     *
+ *                                                                            *
+ * Comment: with local_view set the instance is taken from the local view     *
+ *          of the service, otherwise from the shared cache which stays       *
+ *          locked. cloud_instance_release() must be called in both cases     *
+ *          when the instance is no longer used.                              *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_deltacloud_instance_t	*cloud_instance_get_ext(AGENT_REQUEST *request, AGENT_RESULT *result,
+		zbx_deltacloud_service_t **service, int local_view)
+{
+	char				*instance_id;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (request->nparam != 6)
+	{
+		/* set optional error message */
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid number of parameters e.g.) %s[url, key, secret, driver, provider, instance_id]",
+				request->key));
+		return NULL;
+	}
+
+	if (NULL == (*service = cloud_instance_service_get(request, local_view)))
+	{
+		SET_MSG_RESULT(result, strdup("No Data"));
+		return NULL;
+	}
+
+	instance_id = get_rparam(request, 5);
+
+	if (SUCCEED != cloud_missing_id_find(*service, instance_id))
+	{
+		if (NULL != (instance = cloud_instance_index_find(*service, &(*service)->id_index, instance_id)))
+			return instance;
+
+		cloud_missing_id_add(*service, instance_id);
+	}
+
+	SET_MSG_RESULT(result, strdup("Not match data"));
+	return NULL;
+}
+
+static zbx_deltacloud_instance_t	*cloud_instance_get(AGENT_REQUEST *request, AGENT_RESULT *result,
+		zbx_deltacloud_service_t **service)
+{
+	return cloud_instance_get_ext(request, result, service, CONFIG_LOCAL_VIEW);
+}
+
+static void	cloud_instance_release(void)
+{
+	if (0 == cloud_instance_locked)
+		return;
+
+	cloud_instance_locked = 0;
+	cloud_unlock();
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_instance_list                                   *
+ *                                                                            *
+ * Purpose: Discovering cloud instances list from deltacloud                  *
+ *                                                                            *
+ * Parameters: request - structure that contains item key and parameters      *
+ *              request->key - item key without parameters                    *
+ *              request->nparam - number of parameters                        *
+ *              request->timeout - processing should not take longer than     *
+ *                                 this number of seconds                     *
+ *              request->params[N-1] - pointers to item key parameters        *
+ *                                                                            *
+ *             result - structure that will contain result                    *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: get_rparam(request, N-1) can be used to get a pointer to the Nth  *
+ *          parameter starting from 0 (first parameter). Make sure it exists  *
+ *          by checking value of request->nparam.                             *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_instance_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int i,j;
+	struct zbx_json json;
+	char	*url;
+	char	*key;
+	char	*secret;
+	char	*driver;
+	char	*provider;
+	zbx_deltacloud_service_t	*service = NULL;
+
+	if (request->nparam != 5)
+	{
+		/* set optional error message */
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instance.list[url, key, secret, driver, provider]"));
+		return SYSINFO_RET_FAIL;
+	}
+	url = get_rparam(request, 0);
+	key = get_rparam(request, 1);
+	secret = get_rparam(request, 2);
+	driver = get_rparam(request, 3);
+	provider = get_rparam(request, 4);
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+
+	if (NULL == service)
+	{
+		cloud_unlock();
+		SET_MSG_RESULT(result, strdup("No instances"));
+		return SYSINFO_RET_OK;
+	}
+	
+	// json format init
+	zbx_json_init(&json, ZBX_JSON_STAT_BUF_LEN);
+	// Add "data":[] for LLD format
+	zbx_json_addarray(&json, ZBX_PROTO_TAG_DATA);
+	for (i = 0; i < service->instances.values_num; i++)
+	{
+		zbx_deltacloud_instance_t *instance = service->instances.values[i];
+
+		zbx_json_addobject(&json, NULL);
+		if (NULL != instance->name)
+			zbx_json_addstring(&json, NAME_MACRO, instance->name, ZBX_JSON_TYPE_STRING);
+		if (NULL != instance->id)
+			zbx_json_addstring(&json, ID_MACRO, instance->id, ZBX_JSON_TYPE_STRING);
+		for (j = 0; j < instance->public_addresses.values_num; j++)
+		{
+			zbx_deltacloud_address_t *address = instance->public_addresses.values[j];
+			zbx_json_addstring(&json, PUBLIC_ADDR_MACRO, address->address, ZBX_JSON_TYPE_STRING);
+			break; /* the macro takes the first address, see cloud.instance.by_addr for all */
+		}
+		
+		for (j = 0; j < instance->private_addresses.values_num; j++)
+		{
+			zbx_deltacloud_address_t *address = instance->private_addresses.values[j];
+			zbx_json_addstring(&json, PRIVATE_ADDR_MACRO, address->address, ZBX_JSON_TYPE_STRING);
+			break; /* the macro takes the first address, see cloud.instance.by_addr for all */
+		}
+		zbx_json_close(&json);
+	}
+
+	cloud_unlock();
+
+	SET_STR_RESULT(result, strdup(json.buffer));
+	zbx_json_free(&json);
+	
+	return SYSINFO_RET_OK;
+}
+
+static void	cloud_export_value(char **data, size_t *data_alloc, size_t *data_offset, const char *value)
+{
+	if (NULL == value)
+	{
+		zbx_strcpy_alloc(data, data_alloc, data_offset, "null");
+		return;
+	}
+
+	zbx_chrcpy_alloc(data, data_alloc, data_offset, '"');
+
+	for (; '\0' != *value; value++)
+	{
+		switch (*value)
+		{
+			case '"':
+				zbx_strcpy_alloc(data, data_alloc, data_offset, "\\\"");
+				break;
+			case '\\':
+				zbx_strcpy_alloc(data, data_alloc, data_offset, "\\\\");
+				break;
+			case '\n':
+				zbx_strcpy_alloc(data, data_alloc, data_offset, "\\n");
+				break;
+			case '\r':
+				zbx_strcpy_alloc(data, data_alloc, data_offset, "\\r");
+				break;
+			case '\t':
+				zbx_strcpy_alloc(data, data_alloc, data_offset, "\\t");
+				break;
+			default:
+				if (0x20 > (unsigned char)*value)
+					zbx_snprintf_alloc(data, data_alloc, data_offset, "\\u%04x", (unsigned char)*value);
+				else
+					zbx_chrcpy_alloc(data, data_alloc, data_offset, *value);
+		}
+	}
+
+	zbx_chrcpy_alloc(data, data_alloc, data_offset, '"');
+}
+
+static void	cloud_export_string(char **data, size_t *data_alloc, size_t *data_offset, const char *name,
+		const char *value)
+{
+	zbx_snprintf_alloc(data, data_alloc, data_offset, ",\"%s\":", name);
+	cloud_export_value(data, data_alloc, data_offset, value);
+}
+
+static void	cloud_export_addresses(char **data, size_t *data_alloc, size_t *data_offset, const char *name,
+		const zbx_vector_ptr_t *addresses)
+{
+	int	i;
+
+	zbx_snprintf_alloc(data, data_alloc, data_offset, ",\"%s\":[", name);
+
+	for (i = 0; i < addresses->values_num; i++)
+	{
+		if (0 != i)
+			zbx_chrcpy_alloc(data, data_alloc, data_offset, ',');
+
+		cloud_export_value(data, data_alloc, data_offset,
+				((zbx_deltacloud_address_t *)addresses->values[i])->address);
+	}
+
+	zbx_chrcpy_alloc(data, data_alloc, data_offset, ']');
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_export_instance                                            *
+ *                                                                            *
+ * Purpose: format all cached attributes of the instance as one JSON line     *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_export_instance(char **data, size_t *data_alloc, size_t *data_offset,
+		const zbx_deltacloud_service_t *service, const zbx_deltacloud_instance_t *instance)
+{
+	const zbx_deltacloud_hardware_profile_t	*hwp;
+	const zbx_deltacloud_instance_cold_t	*cold = instance->cold;
+
+	zbx_strcpy_alloc(data, data_alloc, data_offset, "{\"id\":");
+	cloud_export_value(data, data_alloc, data_offset, instance->id);
+	cloud_export_string(data, data_alloc, data_offset, "name", instance->name);
+	cloud_export_string(data, data_alloc, data_offset, "href", NULL != cold ? cold->href : NULL);
+	cloud_export_string(data, data_alloc, data_offset, "owner_id", NULL != cold ? cold->owner_id : NULL);
+	cloud_export_string(data, data_alloc, data_offset, "image_id", instance->image_id);
+	cloud_export_string(data, data_alloc, data_offset, "image_href", NULL != cold ? cold->image_href : NULL);
+	cloud_export_string(data, data_alloc, data_offset, "realm_id", instance->realm_id);
+	cloud_export_string(data, data_alloc, data_offset, "realm_href", NULL != cold ? cold->realm_href : NULL);
+	cloud_export_string(data, data_alloc, data_offset, "state", instance->state);
+	zbx_snprintf_alloc(data, data_alloc, data_offset, ",\"state_since\":%d", instance->history.since);
+	cloud_export_string(data, data_alloc, data_offset, "launch_time", NULL != cold ? cold->launch_time : NULL);
+	cloud_export_addresses(data, data_alloc, data_offset, "public_addresses", &instance->public_addresses);
+	cloud_export_addresses(data, data_alloc, data_offset, "private_addresses", &instance->private_addresses);
+
+	if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)))
+	{
+		zbx_strcpy_alloc(data, data_alloc, data_offset, ",\"hwp\":{\"id\":");
+		cloud_export_value(data, data_alloc, data_offset, hwp->id);
+		cloud_export_string(data, data_alloc, data_offset, "name", hwp->name);
+		cloud_export_string(data, data_alloc, data_offset, "href", hwp->href);
+		cloud_export_string(data, data_alloc, data_offset, "architecture", hwp->architecture);
+		zbx_snprintf_alloc(data, data_alloc, data_offset, ",\"cpu\":%g,\"memory\":" ZBX_FS_UI64 ",\"storage\":"
+				ZBX_FS_UI64 "}", hwp->cpu, hwp->memory, hwp->storage);
+	}
+	else
+		zbx_strcpy_alloc(data, data_alloc, data_offset, ",\"hwp\":null");
+
+	zbx_strcpy_alloc(data, data_alloc, data_offset, "}\n");
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_export_write                                               *
+ *                                                                            *
+ * Purpose: write the cached instances of the service to the file in          *
+ *          batches                                                           *
+ *                                                                            *
+ * Parameters: f       - [IN] the export file                                 *
+ *             service - [IN] the shared service                              *
+ *             num     - [OUT] number of written instances                    *
+ *             error   - [OUT] error message                                  *
+ *                                                                            *
+ * Return value: SUCCEED - a consistent snapshot of the service was written   *
+ *               FAIL - the file cannot be written or the service kept        *
+ *                      changing, error is set                                *
+ *                                                                            *
+ * Comment: each batch of CLOUD_EXPORT_BATCH instances is formatted with the  *
+ *          cache locked and written with the cache unlocked, so the memory   *
+ *          of the export does not grow with the number of instances. If the  *
+ *          service changes between batches the file is written again from   *
+ *          the start.                                                        *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_export_write(FILE *f, zbx_deltacloud_service_t *service, int *num, char **error)
+{
+	int		i, start = 0, retries = 0, ret = FAIL;
+	char		*data = NULL;
+	size_t		data_alloc = 0, data_offset;
+	zbx_uint64_t	generation = 0;
+
+	for (;;)
+	{
+		data_offset = 0;
+
+		cloud_lock();
+
+		if (0 == start)
+		{
+			generation = service->generation;
+		}
+		else if (generation != service->generation)
+		{
+			cloud_unlock();
+
+			if (CLOUD_EXPORT_RETRIES == ++retries)
+			{
+				*error = zbx_strdup(*error, "service kept changing during the export");
+				break;
+			}
+
+			start = 0;
+
+			if (0 != fflush(f) || 0 != ftruncate(fileno(f), 0) || 0 != fseek(f, 0, SEEK_SET))
+			{
+				*error = zbx_strdup(*error, zbx_strerror(errno));
+				break;
+			}
+
+			continue;
+		}
+
+		for (i = start; i < service->instances.values_num && i < start + CLOUD_EXPORT_BATCH; i++)
+			cloud_export_instance(&data, &data_alloc, &data_offset, service, service->instances.values[i]);
+
+		*num = service->instances.values_num;
+
+		cloud_unlock();
+
+		if (0 != data_offset && data_offset != fwrite(data, 1, data_offset, f))
+		{
+			*error = zbx_strdup(*error, zbx_strerror(errno));
+			break;
+		}
+
+		if (*num <= (start = i))
+		{
+			ret = SUCCEED;
+			break;
+		}
+	}
+
+	zbx_free(data);
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_instance_export                                 *
+ *                                                                            *
+ * Purpose: export the whole cached snapshot of the service as NDJSON file,   *
+ *          one instance per line                                             *
+ *                                                                            *
+ * Parameters: request - cloud.instance.export[url, key, secret, driver,      *
+ *                       provider, file]                                      *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - number of exported instances is returned    *
+ *               SYSINFO_RET_FAIL - export is disabled, the file name is      *
+ *                                  invalid or the file cannot be written     *
+ *                                                                            *
+ * Comment: the file is created in ExportDir, the file name must not contain  *
+ *          a directory. The instances are written in batches, see            *
+ *          cloud_export_write(), so other processes are not blocked by the   *
+ *          file I/O. The snapshot is written to "<file>.tmp" and renamed, so *
+ *          readers never see a partial export.                               *
+ *          If cold attributes of some instances are not cached the service   *
+ *          is refreshed first, the refresh stores them because the export    *
+ *          records the demand. While the circuit breaker of the service is   *
+ *          open or if the refresh fails they are exported as null.           *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_instance_export(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				i, now, num = 0, refresh = 0, ret = SYSINFO_RET_FAIL;
+	char				*file, *path, *tmp_file, *error = NULL;
+	FILE				*f;
+	zbx_deltacloud_service_t	*service;
+
+	if (request->nparam != 6)
+	{
+		/* set optional error message */
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instance.export[url, key, secret, driver, provider, file]"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (NULL == CONFIG_EXPORT_DIR)
+	{
+		SET_MSG_RESULT(result, strdup("Export is disabled, set ExportDir in the module configuration"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	file = get_rparam(request, 5);
+
+	if ('\0' == *file || NULL != strchr(file, '/') || NULL != strstr(file, ".."))
+	{
+		SET_MSG_RESULT(result, strdup("Invalid sixth parameter"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	now = time(NULL);
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+
+	if (NULL != service)
+	{
+		/* the refreshes during the export keep the cold attributes */
+		service->cold_demand = now;
+
+		for (i = 0; i < service->instances.values_num; i++)
+		{
+			if (NULL == ((zbx_deltacloud_instance_t *)service->instances.values[i])->cold)
+				break;
+		}
+
+		if (i != service->instances.values_num && SUCCEED == cloud_service_breaker_allow(service, now))
+		{
+			service->lastcheck = now;
+			refresh = 1;
+		}
+	}
+
+	cloud_unlock();
+
+	if (NULL == service)
+	{
+		SET_MSG_RESULT(result, strdup("No Data"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	/* a failed refresh keeps the cached instances */
+	if (1 == refresh)
+	{
+		cloud_service_refresh(service, get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+				get_rparam(request, 3), get_rparam(request, 4));
+	}
+
+	path = zbx_dsprintf(NULL, "%s/%s", CONFIG_EXPORT_DIR, file);
+	tmp_file = zbx_dsprintf(NULL, "%s.tmp", path);
+
+	if (NULL == (f = fopen(tmp_file, "w")))
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot open \"%s\": %s", tmp_file, zbx_strerror(errno)));
+	}
+	else
+	{
+		if (SUCCEED != cloud_export_write(f, service, &num, &error))
+		{
+			SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot write \"%s\": %s", tmp_file, error));
+			fclose(f);
+		}
+		else if (0 != fclose(f))
+			SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot write \"%s\": %s", tmp_file, zbx_strerror(errno)));
+		else if (0 != rename(tmp_file, path))
+			SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot rename \"%s\": %s", tmp_file, zbx_strerror(errno)));
+		else
+		{
+			SET_UI64_RESULT(result, num);
+			ret = SYSINFO_RET_OK;
+		}
+
+		if (SYSINFO_RET_OK != ret)
+			unlink(tmp_file);
+	}
+
+	zbx_free(error);
+	zbx_free(tmp_file);
+	zbx_free(path);
+
+	return ret;
+}
+	
+/* size of the shared cache chunk holding ptr, 0 for NULL */
+static zbx_uint64_t	cloud_mem_size(const void *ptr)
+{
+	if (NULL == ptr)
+		return 0;
+
+	return CLOUD_MEM_CHUNK_SIZE((const char *)ptr - sizeof(zbx_uint64_t));
+}
+
+/* shared cache memory needed to store fetched data */
+typedef struct
+{
+	zbx_uint64_t	size;	/* sum of the chunk sizes */
+	zbx_uint64_t	chunks;
+}
+zbx_cloud_mem_estimate_t;
+
+/* memory taken by the estimated chunks, each chunk also takes two size fields */
+#define CLOUD_MEM_ESTIMATE_TOTAL(estimate)	((estimate)->size + (estimate)->chunks * 2 * sizeof(zbx_uint64_t))
+
+static void	cloud_mem_estimate_add(zbx_cloud_mem_estimate_t *estimate, size_t size)
+{
+	estimate->size += CLOUD_MEM_ALLOC_SIZE(size);
+	estimate->chunks++;
+}
+
+static void	cloud_mem_estimate_str(zbx_cloud_mem_estimate_t *estimate, const char *str)
+{
+	if (NULL != str)
+		cloud_mem_estimate_add(estimate, strlen(str) + 1);
+}
+
+static zbx_uint64_t	cloud_addresses_mem_size(const zbx_vector_ptr_t *addresses)
+{
+	int				i;
+	zbx_uint64_t			size;
+	const zbx_deltacloud_address_t	*address;
+
+	size = cloud_mem_size(addresses->values);
+
+	for (i = 0; i < addresses->values_num; i++)
+	{
+		address = addresses->values[i];
+		size += cloud_mem_size(address) + cloud_mem_size(address->address);
+	}
+
+	return size;
+}
+
+/* shared cache memory taken by an instance index, the keys are counted with the instances */
+static zbx_uint64_t	cloud_index_mem_size(const zbx_hashset_t *index)
+{
+	int				i;
+	zbx_uint64_t			size;
+	const ZBX_HASHSET_ENTRY_T	*entry;
+
+	size = cloud_mem_size(index->slots);
+
+	for (i = 0; i < index->num_slots; i++)
+	{
+		for (entry = index->slots[i]; NULL != entry; entry = entry->next)
+			size += cloud_mem_size(entry);
+	}
+
+	return size;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instances_mem_size                                         *
+ *                                                                            *
+ * Purpose: get the shared cache memory taken by the instances, their indexes *
+ *          and hardware profiles of the service                              *
+ *                                                                            *
+ * Comment: must be called with the cache locked                              *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_uint64_t	cloud_instances_mem_size(const zbx_deltacloud_service_t *service)
+{
+	int					i;
+	zbx_uint64_t				size;
+	const zbx_deltacloud_instance_t		*instance;
+	const zbx_deltacloud_hardware_profile_t	*hwp;
+
+	size = cloud_mem_size(service->instances.values) + cloud_mem_size(service->hardware_profiles.values) +
+			cloud_index_mem_size(&service->id_index) + cloud_index_mem_size(&service->name_index) +
+			cloud_index_mem_size(&service->addr_index);
+
+	for (i = 0; i < service->instances.values_num; i++)
+	{
+		instance = service->instances.values[i];
+
+		size += cloud_mem_size(instance) + cloud_mem_size(instance->id) + cloud_mem_size(instance->name) +
+				cloud_mem_size(instance->image_id) + cloud_mem_size(instance->realm_id) +
+				cloud_mem_size(instance->state);
+
+		if (NULL != instance->cold)
+		{
+			size += cloud_mem_size(instance->cold) + cloud_mem_size(instance->cold->href) +
+					cloud_mem_size(instance->cold->owner_id) +
+					cloud_mem_size(instance->cold->image_href) +
+					cloud_mem_size(instance->cold->realm_href) +
+					cloud_mem_size(instance->cold->launch_time);
+		}
+
+		size += cloud_addresses_mem_size(&instance->public_addresses);
+		size += cloud_addresses_mem_size(&instance->private_addresses);
+	}
+
+	for (i = 0; i < service->hardware_profiles.values_num; i++)
+	{
+		hwp = service->hardware_profiles.values[i];
+
+		size += cloud_mem_size(hwp) + cloud_mem_size(hwp->href) + cloud_mem_size(hwp->id) +
+				cloud_mem_size(hwp->name) + cloud_mem_size(hwp->architecture);
+	}
+
+	return size;
+}
+
+/* estimate the addresses of a fetched instance, returns their number */
+static int	cloud_addresses_mem_estimate(const struct deltacloud_address *addresses, zbx_cloud_mem_estimate_t *estimate)
+{
+	int	addresses_num = 0;
+
+	for (; NULL != addresses; addresses = addresses->next)
+	{
+		cloud_mem_estimate_add(estimate, sizeof(zbx_deltacloud_address_t));
+		cloud_mem_estimate_str(estimate, addresses->address);
+		addresses_num++;
+	}
+
+	if (0 != addresses_num)
+		cloud_mem_estimate_add(estimate, addresses_num * sizeof(void *));
+
+	return addresses_num;
+}
+
+/* estimate the slots of a hashset created for the keys, the hashset rounds their number up to a prime */
+static void	cloud_index_slots_estimate(int keys_num, zbx_cloud_mem_estimate_t *estimate)
+{
+	cloud_mem_estimate_add(estimate, next_prime(CLOUD_INDEX_INIT_SIZE(keys_num)) * sizeof(ZBX_HASHSET_ENTRY_T *));
+}
+
+/* estimate an index of the keys */
+static void	cloud_index_mem_estimate(int keys_num, zbx_cloud_mem_estimate_t *estimate)
+{
+	int	i;
+
+	cloud_index_slots_estimate(keys_num, estimate);
+
+	for (i = 0; i < keys_num; i++)
+		cloud_mem_estimate_add(estimate, offsetof(ZBX_HASHSET_ENTRY_T, data) + sizeof(zbx_cloud_instance_ref_t));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instances_mem_estimate                                     *
+ *                                                                            *
+ * Purpose: estimate the shared cache memory fetched instances will take      *
+ *                                                                            *
+ * Parameters: instances  - the fetched instances                             *
+ *             store_cold - SUCCEED if cold attributes will be stored         *
+ *             estimate   - [OUT] the estimate                                *
+ *                                                                            *
+ * Return value: number of distinct hardware profiles of the instances        *
+ *                                                                            *
+ * Comment: follows the allocations of cloud_service_update_instances()       *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_instances_mem_estimate(const struct deltacloud_instance *instances, int store_cold,
+		zbx_cloud_mem_estimate_t *estimate)
+{
+	int					i, instances_num = 0, addresses_num = 0, hwp_num;
+	const struct deltacloud_instance	*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+	zbx_vector_ptr_t			hwps;
+
+	memset(estimate, 0, sizeof(zbx_cloud_mem_estimate_t));
+	zbx_vector_ptr_create(&hwps);
+
+	for (instance = instances; NULL != instance; instance = instance->next)
+	{
+		instances_num++;
+
+		cloud_mem_estimate_add(estimate, sizeof(zbx_deltacloud_instance_t));
+		cloud_mem_estimate_str(estimate, instance->id);
+		cloud_mem_estimate_str(estimate, instance->name);
+		cloud_mem_estimate_str(estimate, instance->image_id);
+		cloud_mem_estimate_str(estimate, instance->realm_id);
+		cloud_mem_estimate_str(estimate, instance->state);
+
+		if (SUCCEED == store_cold)
+		{
+			cloud_mem_estimate_add(estimate, sizeof(zbx_deltacloud_instance_cold_t));
+			cloud_mem_estimate_str(estimate, instance->href);
+			cloud_mem_estimate_str(estimate, instance->owner_id);
+			cloud_mem_estimate_str(estimate, instance->image_href);
+			cloud_mem_estimate_str(estimate, instance->realm_href);
+			cloud_mem_estimate_str(estimate, instance->launch_time);
+		}
+
+		addresses_num += cloud_addresses_mem_estimate(instance->public_addresses, estimate);
+		addresses_num += cloud_addresses_mem_estimate(instance->private_addresses, estimate);
+
+		if (NULL == instance->hwp.id)
+			continue;
+
+		hwp = zbx_malloc(NULL, sizeof(zbx_deltacloud_hardware_profile_t));
+		cloud_hardware_profile_parse(hwp, &instance->hwp);
+
+		for (i = 0; i < hwps.values_num; i++)
+		{
+			if (SUCCEED == cloud_hardware_profile_equal(hwps.values[i], hwp))
+				break;
+		}
+
+		if (i < hwps.values_num)
+		{
+			zbx_free(hwp);
+			continue;
+		}
+
+		cloud_mem_estimate_add(estimate, sizeof(zbx_deltacloud_hardware_profile_t));
+		cloud_mem_estimate_str(estimate, hwp->href);
+		cloud_mem_estimate_str(estimate, hwp->id);
+		cloud_mem_estimate_str(estimate, hwp->name);
+		cloud_mem_estimate_str(estimate, hwp->architecture);
+
+		zbx_vector_ptr_append(&hwps, hwp);
+	}
+
+	if (0 != instances_num)
+		cloud_mem_estimate_add(estimate, instances_num * sizeof(void *));
+
+	if (0 != (hwp_num = hwps.values_num))
+		cloud_mem_estimate_add(estimate, hwp_num * sizeof(void *));
+
+	/* missing and duplicate keys are not inserted, they only make the estimate larger */
+	cloud_index_mem_estimate(instances_num, estimate);
+	cloud_index_mem_estimate(instances_num, estimate);
+	cloud_index_mem_estimate(addresses_num, estimate);
+
+	zbx_vector_ptr_clean(&hwps, ZBX_DEFAULT_MEM_FREE_FUNC);
+	zbx_vector_ptr_destroy(&hwps);
+
+	return hwp_num;
+}
+
+typedef struct
+{
+	zbx_uint64_t	free_size;
+	zbx_uint64_t	used_size;
+	zbx_uint64_t	free_chunks;
+	zbx_uint64_t	largest_free_chunk;
+	double		fragmentation;	/* percentage of free space outside the largest free chunk */
+}
+zbx_cloud_mem_stats_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_mem_stats                                                  *
+ *                                                                            *
+ * Purpose: collect free chunk statistics of the cloud shared segment         *
+ *                                                                            *
+ * Comment: walks the allocator free lists, must be called with the cache     *
+ *          locked                                                            *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_mem_stats(zbx_cloud_mem_stats_t *stats)
+{
+	int		i;
+	void		*chunk;
+	zbx_uint64_t	size;
+
+	memset(stats, 0, sizeof(zbx_cloud_mem_stats_t));
+
+	stats->free_size = cloud_mem->free_size;
+	stats->used_size = cloud_mem->used_size;
+
+	for (i = 0; i < CLOUD_MEM_BUCKET_COUNT; i++)
+	{
+		for (chunk = cloud_mem->buckets[i]; NULL != chunk; chunk = CLOUD_MEM_CHUNK_NEXT(chunk))
+		{
+			size = CLOUD_MEM_CHUNK_SIZE(chunk);
+
+			if (stats->largest_free_chunk < size)
+				stats->largest_free_chunk = size;
+
+			stats->free_chunks++;
+		}
+	}
+
+	if (0 != stats->free_size)
+		stats->fragmentation = 100.0 * (stats->free_size - stats->largest_free_chunk) / stats->free_size;
+}
+
+static zbx_uint64_t	cloud_service_mem_limit(const zbx_deltacloud_service_t *service)
+{
+	return 0 != service->mem_limit ? service->mem_limit : CONFIG_SERVICE_MEMORY_LIMIT;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_mem_reserve                                        *
+ *                                                                            *
+ * Purpose: check if fetched data fits into the memory limit of the service   *
+ *          and into the shared cache                                         *
+ *                                                                            *
+ * Parameters: service  - the service                                         *
+ *             old_size - memory taken by the data being replaced             *
+ *             estimate - memory the fetched data will take                   *
+ *             what     - the data for the log message                        *
+ *                                                                            *
+ * Return value: SUCCEED - the data can replace the cached data               *
+ *               FAIL - the data does not fit, the overflow is counted        *
+ *                                                                            *
+ * Comment: the check of the whole cache keeps the allocator from running     *
+ *          out of memory, which would end the agent process. It is done      *
+ *          even without a limit so that one service cannot take the memory   *
+ *          other services need. The free memory may be fragmented, so        *
+ *          cloud_service_mem_fit() must be called before the replaced data   *
+ *          is freed.                                                         *
+ *          Must be called with the cache locked.                             *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_mem_reserve(zbx_deltacloud_service_t *service, zbx_uint64_t old_size,
+		const zbx_cloud_mem_estimate_t *estimate, const char *what)
+{
+	zbx_uint64_t	limit, size;
+
+	limit = cloud_service_mem_limit(service);
+	size = service->mem_used - old_size + estimate->size;
+
+	if (0 != limit && size > limit)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "cloud service \"%s\" needs " ZBX_FS_UI64 " bytes for %s, exceeding its"
+				" memory limit of " ZBX_FS_UI64 " bytes: keeping the previous data", service->url,
+				size, what, limit);
+		service->mem_overflows++;
+		return FAIL;
+	}
+
+	if (CLOUD_MEM_ESTIMATE_TOTAL(estimate) > cloud_mem->free_size + old_size)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "cloud cache has no room for %s of service \"%s\": keeping the"
+				" previous data", what, service->url);
+		service->mem_overflows++;
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+/* frees the data of the service being replaced, leaving the service consistent */
+typedef void	(*zbx_cloud_release_func_t)(zbx_deltacloud_service_t *service, int data);
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_restore                                            *
+ *                                                                            *
+ * Purpose: copy the service back into the cache from its heap copy           *
+ *                                                                            *
+ * Parameters: service - the service                                          *
+ *             copy    - heap copy of the service, freed here                 *
+ *                                                                            *
+ * Comment: the generations are kept, the memory is accounted like in        *
+ *          cloud_cache_compact(). Must be called with the cache locked.      *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_service_restore(zbx_deltacloud_service_t *service, zbx_deltacloud_service_t *copy)
+{
+	zbx_uint64_t	used_size, mem_used, generation, hot_generation;
+
+	generation = service->generation;
+	hot_generation = service->hot_generation;
+
+	used_size = cloud_mem->used_size;
+	cloud_service_clear(service, __cloud_mem_free_func);
+	mem_used = service->mem_used - (used_size - cloud_mem->used_size);
+
+	used_size = cloud_mem->used_size;
+	cloud_service_copy(service, copy, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+	service->mem_used = mem_used + cloud_mem->used_size - used_size;
+	service->generation = generation;
+	service->hot_generation = hot_generation;
+
+	cloud_service_clear(copy, ZBX_DEFAULT_MEM_FREE_FUNC);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_mem_fit                                            *
+ *                                                                            *
+ * Purpose: make sure the data reserved by cloud_service_mem_reserve() can be *
+ *          allocated                                                         *
+ *                                                                            *
+ * Parameters: service      - the service                                     *
+ *             old_size     - memory taken by the data being replaced         *
+ *             estimate     - memory the data will take                       *
+ *             release_func - frees the data being replaced, NULL if nothing  *
+ *                            is replaced                                     *
+ *             data         - passed to release_func                          *
+ *             what         - the data for the log message                    *
+ *                                                                            *
+ * Return value: SUCCEED - the data fits into the largest free chunk, the     *
+ *                         replaced data may have been freed already          *
+ *               FAIL - the free memory is too fragmented even after          *
+ *                      compaction, the replaced data is kept and the         *
+ *                      overflow is counted                                   *
+ *                                                                            *
+ * Comment: a failed allocation would end the agent process, so the data      *
+ *          must fit into one free chunk. If it does not, the cache is        *
+ *          compacted. If only the replaced data keeps it from fitting, that  *
+ *          data is freed and the cache compacted again, with a heap copy of  *
+ *          the service to restore it from if the data still does not fit.    *
+ *          Compaction moves the contents of all services: callers must not   *
+ *          keep pointers into the services across this call.                 *
+ *          Must be called with the cache locked, before the replaced data is *
+ *          freed.                                                            *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_mem_fit(zbx_deltacloud_service_t *service, zbx_uint64_t old_size,
+		const zbx_cloud_mem_estimate_t *estimate, zbx_cloud_release_func_t release_func, int data,
+		const char *what)
+{
+	zbx_cloud_mem_stats_t		stats;
+	zbx_deltacloud_service_t	copy;
+	zbx_uint64_t			used_size;
+
+	cloud_mem_stats(&stats);
+
+	if (CLOUD_MEM_ESTIMATE_TOTAL(estimate) <= stats.largest_free_chunk)
+		return SUCCEED;
+
+	cloud_cache_compact();
+	cloud_mem_stats(&stats);
+
+	if (CLOUD_MEM_ESTIMATE_TOTAL(estimate) <= stats.largest_free_chunk)
+		return SUCCEED;
+
+	/* cloud_service_mem_reserve() made sure that the memory is there once the replaced data is freed */
+	if (NULL != release_func && 0 != old_size)
+	{
+		cloud_service_copy(&copy, service, ZBX_DEFAULT_MEM_MALLOC_FUNC, ZBX_DEFAULT_MEM_REALLOC_FUNC,
+				ZBX_DEFAULT_MEM_FREE_FUNC);
+
+		used_size = cloud_mem->used_size;
+		release_func(service, data);
+		service->mem_used -= used_size - cloud_mem->used_size;
+
+		cloud_cache_compact();
+		cloud_mem_stats(&stats);
+
+		if (CLOUD_MEM_ESTIMATE_TOTAL(estimate) <= stats.largest_free_chunk)
+		{
+			cloud_service_clear(&copy, ZBX_DEFAULT_MEM_FREE_FUNC);
+			return SUCCEED;
+		}
+
+		cloud_service_restore(service, &copy);
+	}
+
+	zabbix_log(LOG_LEVEL_WARNING, "cloud cache is too fragmented for %s of service \"%s\": keeping the"
+			" previous data", what, service->url);
+	service->mem_overflows++;
+
+	return FAIL;
+}
+
+/* point the cold attributes at the fetched instance, nothing is copied */
+static void	cloud_instance_cold_set(zbx_deltacloud_instance_cold_t *cold, const struct deltacloud_instance *instance)
+{
+	cold->href = instance->href;
+	cold->owner_id = instance->owner_id;
+	cold->image_href = instance->image_href;
+	cold->realm_href = instance->realm_href;
+	cold->launch_time = instance->launch_time;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_cold_wanted                                        *
+ *                                                                            *
+ * Purpose: check if refreshes should store cold instance attributes          *
+ *                                                                            *
+ * Return value: SUCCEED - a cold attribute was read within the last          *
+ *                         ColdFieldsTimeout seconds or the timeout is 0      *
+ *               FAIL - otherwise                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_cold_wanted(const zbx_deltacloud_service_t *service, int now)
+{
+	if (0 == CONFIG_COLD_FIELDS_TIMEOUT)
+		return SUCCEED;
+
+	if (0 != service->cold_demand && now - service->cold_demand < CONFIG_COLD_FIELDS_TIMEOUT)
+		return SUCCEED;
+
+	return FAIL;
+}
+
+/* state of a previous instance, see cloud_instances_history_save() */
+typedef struct
+{
+	char				*id;
+	char				*state;
+	zbx_cloud_state_history_t	history;
+}
+zbx_cloud_instance_history_t;
+
+static zbx_hash_t	cloud_instance_history_hash(const void *data)
+{
+	const zbx_cloud_instance_history_t	*history = (const zbx_cloud_instance_history_t *)data;
+
+	return ZBX_DEFAULT_STRING_HASH_ALGO(history->id, strlen(history->id), ZBX_DEFAULT_HASH_SEED);
+}
+
+static int	cloud_instance_history_compare(const void *d1, const void *d2)
+{
+	const zbx_cloud_instance_history_t	*h1 = (const zbx_cloud_instance_history_t *)d1;
+	const zbx_cloud_instance_history_t	*h2 = (const zbx_cloud_instance_history_t *)d2;
+
+	return strcmp(h1->id, h2->id);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instances_history_save                                     *
+ *                                                                            *
+ * Purpose: copy states and state histories of the cached instances to the    *
+ *          process heap before the instances are freed                       *
+ *                                                                            *
+ * Parameters: service   - the service                                        *
+ *             histories - [OUT] zbx_cloud_instance_history_t indexed by id   *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_instances_history_save(const zbx_deltacloud_service_t *service, zbx_hashset_t *histories)
+{
+	int					i;
+	const zbx_deltacloud_instance_t		*instance;
+	zbx_cloud_instance_history_t		history_local, *history;
+
+	zbx_hashset_create(histories, MAX(service->instances.values_num, CLOUD_COLLECTION_INIT_SIZE),
+			cloud_instance_history_hash, cloud_instance_history_compare);
+
+	for (i = 0; i < service->instances.values_num; i++)
+	{
+		instance = service->instances.values[i];
+
+		if (NULL == instance->id)
+			continue;
+
+		history_local.id = zbx_strdup(NULL, instance->id);
+		history_local.state = (NULL != instance->state ? zbx_strdup(NULL, instance->state) : NULL);
+		history_local.history = instance->history;
+
+		history = zbx_hashset_insert(histories, &history_local, sizeof(history_local));
+
+		/* the first of duplicate ids is kept, like in the instance lookup */
+		if (history->id != history_local.id)
+		{
+			zbx_free(history_local.id);
+			zbx_free(history_local.state);
+		}
+	}
+}
+
+static void	cloud_instances_history_free(zbx_hashset_t *histories)
+{
+	zbx_hashset_iter_t		iter;
+	zbx_cloud_instance_history_t	*history;
+
+	zbx_hashset_iter_reset(histories, &iter);
+
+	while (NULL != (history = zbx_hashset_iter_next(&iter)))
+	{
+		zbx_free(history->id);
+		zbx_free(history->state);
+	}
+
+	zbx_hashset_destroy(histories);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_history_update                                    *
+ *                                                                            *
+ * Purpose: carry the state history of the instance over from its previous   *
+ *          copy and record a state change                                    *
+ *                                                                            *
+ * Parameters: instance  - the fetched instance                               *
+ *             histories - states of the previous instances                   *
+ *             now       - time of the refresh                                *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_instance_history_update(zbx_deltacloud_instance_t *instance, const zbx_hashset_t *histories,
+		int now)
+{
+	zbx_cloud_instance_history_t	history_local, *previous;
+	zbx_cloud_state_history_t	*history = &instance->history;
+
+	history_local.id = instance->id;
+
+	if (NULL == instance->id || NULL == (previous = zbx_hashset_search((zbx_hashset_t *)histories,
+			&history_local)))
+	{
+		memset(history, 0, sizeof(zbx_cloud_state_history_t));
+		history->since = now;
+		return;
+	}
+
+	*history = previous->history;
+
+	if (0 == zbx_strcmp_null(previous->state, instance->state))
+		return;
+
+	history->since = now;
+	history->changes[history->changes_next] = now;
+	history->changes_next = (history->changes_next + 1) % CLOUD_STATE_CHANGES_MAX;
+
+	if (CLOUD_STATE_CHANGES_MAX > history->changes_num)
+		history->changes_num++;
+}
+
+/* copy all fetched addresses of an instance into the shared cache */
+static void	cloud_addresses_shared_set(zbx_vector_ptr_t *dst, const struct deltacloud_address *addresses)
+{
+	int				addresses_num = 0;
+	const struct deltacloud_address	*src;
+	zbx_deltacloud_address_t	*address;
+
+	CLOUD_VECTOR_CREATE(dst, ptr);
+
+	for (src = addresses; NULL != src; src = src->next)
+		addresses_num++;
+
+	if (0 == addresses_num)
+		return;
+
+	zbx_vector_ptr_reserve(dst, addresses_num);
+
+	for (src = addresses; NULL != src; src = src->next)
+	{
+		address = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_address_t));
+		memset(address, 0, sizeof(zbx_deltacloud_address_t));
+		address->address = cloud_shared_strdup(src->address);
+		zbx_vector_ptr_append(dst, address);
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instances_shared_reset                                     *
+ *                                                                            *
+ * Purpose: free the instances, hardware profiles and instance indexes of the *
+ *          service and create the vectors again, sized exactly for the new   *
+ *          ones                                                              *
+ *                                                                            *
+ * Comment: cloud_instances_index() must be called when the new instances     *
+ *          are added. Must be called with the cache locked.                  *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_instances_shared_reset(zbx_deltacloud_service_t *service, int instances_num, int hwp_num)
+{
+	zbx_hashset_destroy(&service->id_index);
+	zbx_hashset_destroy(&service->name_index);
+	zbx_hashset_destroy(&service->addr_index);
+	zbx_vector_ptr_clean(&service->instances, (zbx_mem_free_func_t)cloud_instance_shared_free);
+	zbx_vector_ptr_clean(&service->hardware_profiles, (zbx_mem_free_func_t)cloud_hardware_profile_shared_free);
+	zbx_vector_ptr_destroy(&service->instances);
+	zbx_vector_ptr_destroy(&service->hardware_profiles);
+	CLOUD_VECTOR_CREATE(&service->instances, ptr);
+	CLOUD_VECTOR_CREATE(&service->hardware_profiles, ptr);
+
+	if (0 != instances_num)
+		zbx_vector_ptr_reserve(&service->instances, instances_num);
+
+	if (0 != hwp_num)
+		zbx_vector_ptr_reserve(&service->hardware_profiles, hwp_num);
+}
+
+/* free the instances of the service, leaving it consistent without instances */
+static void	cloud_instances_release(zbx_deltacloud_service_t *service, int data)
+{
+	ZBX_UNUSED(data);
+
+	cloud_instances_shared_reset(service, 0, 0);
+	cloud_instances_index(service, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_update_instances                                   *
+ *                                                                            *
+ * Purpose: replace cached instances of the service with fetched ones         *
+ *                                                                            *
+ * Return value: SUCCEED - the instances were replaced                        *
+ *               FAIL - the fetched instances do not fit into the memory      *
+ *                      limit of the service or into the cache, the cached    *
+ *                      instances are kept                                    *
+ *                                                                            *
+ * Comment: must be called with the cache locked                              *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_update_instances(zbx_deltacloud_service_t *service, const struct deltacloud_instance *instances)
+{
+	const struct deltacloud_instance	*instance;
+	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	zbx_deltacloud_instance_cold_t	cold;
+	zbx_cloud_mem_estimate_t	estimate;
+	zbx_uint64_t			used_size, old_size;
+	zbx_hashset_t			histories;
+	int				store_cold, instances_num = 0, hwp_num, now;
+
+	now = time(NULL);
+	store_cold = cloud_service_cold_wanted(service, now);
+	hwp_num = cloud_instances_mem_estimate(instances, store_cold, &estimate);
+	old_size = cloud_instances_mem_size(service);
+
+	if (SUCCEED != cloud_service_mem_reserve(service, old_size, &estimate, "instances"))
+		return FAIL;
+
+	for (instance = instances; NULL != instance; instance = instance->next)
+		instances_num++;
+
+	/* saved first, the fit check may free the cached instances */
+	cloud_instances_history_save(service, &histories);
+
+	service->generation++;
+
+	if (SUCCEED != cloud_service_mem_fit(service, old_size, &estimate, cloud_instances_release, 0, "instances"))
+	{
+		service->generation++;
+		cloud_instances_history_free(&histories);
+		return FAIL;
+	}
+
+	used_size = cloud_mem->used_size;
+
+	cloud_instances_shared_reset(service, instances_num, hwp_num);
+
+	for (instance = instances; NULL != instance; instance = instance->next)
+	{
+		deltacloud_instance = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_instance_t));
+		deltacloud_instance->id = cloud_shared_strdup(instance->id);
+		deltacloud_instance->name = cloud_shared_strdup(instance->name);
+		deltacloud_instance->image_id = cloud_shared_strdup(instance->image_id);
+		deltacloud_instance->realm_id = cloud_shared_strdup(instance->realm_id);
+		deltacloud_instance->state = cloud_shared_strdup(instance->state);
+
+		if (SUCCEED == store_cold)
+		{
+			cloud_instance_cold_set(&cold, instance);
+			deltacloud_instance->cold = cloud_instance_cold_copy(&cold, __cloud_mem_malloc_func);
+		}
+		else
+			deltacloud_instance->cold = NULL;
+
+		/* Add IP address information */
+		cloud_addresses_shared_set(&deltacloud_instance->public_addresses, instance->public_addresses);
+		cloud_addresses_shared_set(&deltacloud_instance->private_addresses, instance->private_addresses);
+
+		deltacloud_instance->hwp_index = cloud_hardware_profile_shared_index(service, &instance->hwp);
+		cloud_instance_history_update(deltacloud_instance, &histories, now);
+		zbx_vector_ptr_append(&service->instances, deltacloud_instance);
+	}
+
+	cloud_instances_index(service, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+
+	service->generation++;
+	service->hot_generation++;
+	service->mem_used += cloud_mem->used_size - used_size;
+
+	cloud_instances_history_free(&histories);
+
+	zabbix_log(LOG_LEVEL_DEBUG, "cloud.monitor: %d instances, %d hardware profiles, service memory: " ZBX_FS_UI64
+			" (estimated " ZBX_FS_UI64 "), used_size: " ZBX_FS_UI64, service->instances.values_num,
+			service->hardware_profiles.values_num, service->mem_used, estimate.size, cloud_mem->used_size);
+
+	return SUCCEED;
+}
+
+static void	cloud_resource_add(zbx_vector_ptr_t *resources, const char **values, int values_num)
+{
+	int				i;
+	zbx_deltacloud_resource_t	*resource;
+
+	if (NULL == values[0])
+		return;
+
+	resource = zbx_malloc(NULL, sizeof(zbx_deltacloud_resource_t));
+	memset(resource, 0, sizeof(zbx_deltacloud_resource_t));
+
+	for (i = 0; i < values_num; i++)
+		resource->values[i] = cloud_strdup_ext(values[i], ZBX_DEFAULT_MEM_MALLOC_FUNC);
+
+	zbx_vector_ptr_append(resources, resource);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_fetch                                           *
+ *                                                                            *
+ * Purpose: fetch a collection of the service from the API                    *
+ *                                                                            *
+ * Parameters: api        - initialized API connection                        *
+ *             collection - CLOUD_COLLECTION_*                                *
+ *             resources  - [OUT] fetched resources, allocated in the heap    *
+ *                                                                            *
+ * Return value: SUCCEED - the collection was fetched                         *
+ *               FAIL - the API call failed                                   *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_collection_fetch(struct deltacloud_api *api, int collection, zbx_vector_ptr_t *resources)
+{
+	struct deltacloud_image			*images = NULL, *image;
+	struct deltacloud_realm			*realms = NULL, *realm;
+	struct deltacloud_hardware_profile	*profiles = NULL, *profile;
+	struct deltacloud_storage_volume	*volumes = NULL, *volume;
+	zbx_deltacloud_hardware_profile_t	hwp;
+	char					cpu[MAX_STRING_LEN], memory[MAX_STRING_LEN], storage[MAX_STRING_LEN],
+						capacity[MAX_STRING_LEN];
+
+	switch (collection)
+	{
+		case CLOUD_COLLECTION_IMAGES:
+			if (0 > deltacloud_get_images(api, &images))
+				return FAIL;
+
+			for (image = images; NULL != image; image = image->next)
+			{
+				const char	*values[] = {image->id, image->href, image->name, image->description,
+						image->architecture, image->owner_id, image->state};
+
+				cloud_resource_add(resources, values, ARRSIZE(values));
+			}
+
+			deltacloud_free_image_list(&images);
+			break;
+		case CLOUD_COLLECTION_REALMS:
+			if (0 > deltacloud_get_realms(api, &realms))
+				return FAIL;
+
+			for (realm = realms; NULL != realm; realm = realm->next)
+			{
+				const char	*values[] = {realm->id, realm->href, realm->name, realm->limit, realm->state};
+
+				cloud_resource_add(resources, values, ARRSIZE(values));
+			}
+
+			deltacloud_free_realm_list(&realms);
+			break;
+		case CLOUD_COLLECTION_HARDWARE_PROFILES:
+			if (0 > deltacloud_get_hardware_profiles(api, &profiles))
+				return FAIL;
+
+			for (profile = profiles; NULL != profile; profile = profile->next)
+			{
+				const char	*values[] = {profile->id, profile->href, profile->name, cpu, memory, storage,
+						NULL};
+
+				cloud_hardware_profile_parse(&hwp, profile);
+				zbx_snprintf(cpu, sizeof(cpu), ZBX_FS_DBL, hwp.cpu);
+				zbx_snprintf(memory, sizeof(memory), ZBX_FS_UI64, hwp.memory);
+				zbx_snprintf(storage, sizeof(storage), ZBX_FS_UI64, hwp.storage);
+				values[6] = hwp.architecture;
+
+				cloud_resource_add(resources, values, ARRSIZE(values));
+			}
+
+			deltacloud_free_hardware_profile_list(&profiles);
+			break;
+		case CLOUD_COLLECTION_STORAGE_VOLUMES:
+			if (0 > deltacloud_get_storage_volumes(api, &volumes))
+				return FAIL;
+
+			for (volume = volumes; NULL != volume; volume = volume->next)
+			{
+				const char	*values[] = {volume->id, volume->href, volume->name, volume->created,
+						volume->state, capacity, volume->device, volume->realm_id,
+						volume->mount.instance_id, volume->mount.device_name};
+
+				zbx_snprintf(capacity, sizeof(capacity), ZBX_FS_UI64,
+						cloud_size(volume->capacity.size, volume->capacity.unit));
+
+				cloud_resource_add(resources, values, ARRSIZE(values));
+			}
+
+			deltacloud_free_storage_volume_list(&volumes);
+			break;
+		default:
+			return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_mem_size                                        *
+ *                                                                            *
+ * Purpose: get the shared cache memory taken by a collection                 *
+ *                                                                            *
+ * Comment: must be called with the cache locked                              *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_uint64_t	cloud_collection_mem_size(const zbx_hashset_t *index)
+{
+	int				i, j;
+	zbx_uint64_t			size;
+	const ZBX_HASHSET_ENTRY_T	*entry;
+	const zbx_deltacloud_resource_t	*resource;
+
+	size = cloud_mem_size(index->slots);
+
+	for (i = 0; i < index->num_slots; i++)
+	{
+		for (entry = index->slots[i]; NULL != entry; entry = entry->next)
+		{
+			resource = (const zbx_deltacloud_resource_t *)entry->data;
+			size += cloud_mem_size(entry);
+
+			for (j = 0; j < CLOUD_RESOURCE_FIELDS_MAX; j++)
+				size += cloud_mem_size(resource->values[j]);
+		}
+	}
+
+	return size;
+}
+
+/* shared cache memory taken by the service, mem_used must be equal to it */
+static zbx_uint64_t	cloud_service_mem_size(const zbx_deltacloud_service_t *service)
+{
+	int		i;
+	zbx_uint64_t	size;
+
+	size = cloud_mem_size(service) + cloud_mem_size(service->url) + cloud_mem_size(service->key) +
+			cloud_mem_size(service->secret) + cloud_mem_size(service->driver) +
+			cloud_mem_size(service->provider) + cloud_mem_size(service->fleet) +
+			cloud_instances_mem_size(service);
+
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+		size += cloud_collection_mem_size(&service->collections[i]);
+
+	return size;
+}
+
+/* estimate the shared cache memory fetched resources will take, the index is created again for them */
+static void	cloud_collection_mem_estimate(const zbx_vector_ptr_t *resources, zbx_cloud_mem_estimate_t *estimate)
+{
+	int				i, j;
+	const zbx_deltacloud_resource_t	*resource;
+
+	memset(estimate, 0, sizeof(zbx_cloud_mem_estimate_t));
+
+	cloud_index_slots_estimate(resources->values_num, estimate);
+
+	for (i = 0; i < resources->values_num; i++)
+	{
+		resource = resources->values[i];
+
+		cloud_mem_estimate_add(estimate, offsetof(ZBX_HASHSET_ENTRY_T, data) + sizeof(zbx_deltacloud_resource_t));
+
+		for (j = 0; j < CLOUD_RESOURCE_FIELDS_MAX; j++)
+			cloud_mem_estimate_str(estimate, resource->values[j]);
+	}
+}
+
+/* free the resources of a collection of the service, leaving it empty */
+static void	cloud_collection_release(zbx_deltacloud_service_t *service, int collection)
+{
+	zbx_hashset_t			*index = &service->collections[collection];
+	zbx_hashset_iter_t		iter;
+	zbx_deltacloud_resource_t	*resource;
+
+	zbx_hashset_iter_reset(index, &iter);
+
+	while (NULL != (resource = zbx_hashset_iter_next(&iter)))
+		cloud_resource_clear(resource, __cloud_mem_free_func);
+
+	zbx_hashset_clear(index);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_equal                                           *
+ *                                                                            *
+ * Purpose: check if the fetched resources are the same as the cached ones    *
+ *                                                                            *
+ * Return value: SUCCEED - every fetched resource is cached with the same     *
+ *                         values and nothing else is cached                  *
+ *               FAIL - otherwise, also when the fetched resources contain    *
+ *                      duplicate ids                                         *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_collection_equal(zbx_hashset_t *index, const zbx_vector_ptr_t *resources)
+{
+	int				i, j;
+	const zbx_deltacloud_resource_t	*resource, *cached;
+
+	if (index->num_data != resources->values_num)
+		return FAIL;
+
+	for (i = 0; i < resources->values_num; i++)
+	{
+		resource = resources->values[i];
+
+		if (NULL == (cached = zbx_hashset_search(index, resource)))
+			return FAIL;
+
+		for (j = 0; j < CLOUD_RESOURCE_FIELDS_MAX; j++)
+		{
+			if (0 != zbx_strcmp_null(cached->values[j], resource->values[j]))
+				return FAIL;
+		}
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_update                                          *
+ *                                                                            *
+ * Purpose: replace cached collection of the service with fetched resources   *
+ *                                                                            *
+ * Return value: SUCCEED - the collection was replaced or is unchanged        *
+ *               FAIL - the fetched resources do not fit into the memory      *
+ *                      limit of the service or into the cache, the cached    *
+ *                      collection is kept                                    *
+ *                                                                            *
+ * Comment: an unchanged collection is not rewritten, so the local views do   *
+ *          not copy the service again. Must be called with the cache locked. *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_collection_update(zbx_deltacloud_service_t *service, int collection,
+		const zbx_vector_ptr_t *resources)
+{
+	int				i, j;
+	zbx_hashset_t			*index = &service->collections[collection];
+	zbx_deltacloud_resource_t	*resource, resource_local;
+	zbx_cloud_mem_estimate_t	estimate;
+	zbx_uint64_t			used_size, old_size;
+
+	if (SUCCEED == cloud_collection_equal(index, resources))
+		return SUCCEED;
+
+	cloud_collection_mem_estimate(resources, &estimate);
+	old_size = cloud_collection_mem_size(index);
+
+	if (SUCCEED != cloud_service_mem_reserve(service, old_size, &estimate, cloud_collections[collection].name))
+		return FAIL;
+
+	service->generation++;
+
+	if (SUCCEED != cloud_service_mem_fit(service, old_size, &estimate, cloud_collection_release, collection,
+			cloud_collections[collection].name))
+	{
+		service->generation++;
+		return FAIL;
+	}
+
+	used_size = cloud_mem->used_size;
+
+	cloud_collection_release(service, collection);
+
+	/* sized for the resources, so that the inserts do not grow it beyond the estimate */
+	zbx_hashset_destroy(index);
+	zbx_hashset_create_ext(index, CLOUD_INDEX_INIT_SIZE(resources->values_num), cloud_resource_hash,
+			cloud_resource_compare, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+
+	for (i = 0; i < resources->values_num; i++)
+	{
+		resource = resources->values[i];
+
+		/* the API should not return duplicate ids, but keep the first one if it does */
+		if (NULL != zbx_hashset_search(index, resource))
+			continue;
+
+		for (j = 0; j < CLOUD_RESOURCE_FIELDS_MAX; j++)
+			resource_local.values[j] = cloud_shared_strdup(resource->values[j]);
+
+		zbx_hashset_insert(index, &resource_local, sizeof(resource_local));
+	}
+
+	service->generation++;
+	service->hot_generation++;
+	service->mem_used += cloud_mem->used_size - used_size;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_refresh                                         *
+ *                                                                            *
+ * Purpose: fetch a collection of the service and replace the cached one      *
+ *                                                                            *
+ * Comment: must be called with the cache unlocked, the cached collection is  *
+ *          kept if the API call fails                                        *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_collection_refresh(zbx_deltacloud_service_t *service, int collection, char *url, char *key,
+		char *secret, char *driver, char *provider)
+{
+	int			i;
+	struct deltacloud_api	api;
+	zbx_vector_ptr_t	resources;
+
+	if (0 > deltacloud_initialize(&api, url, key, secret, driver, provider))
+	{
+		zabbix_log(LOG_LEVEL_DEBUG, "cannot initialize API of \"%s\": %s", url,
+				deltacloud_get_last_error_string());
+		return;
+	}
+
+	zbx_vector_ptr_create(&resources);
+
+	if (SUCCEED == cloud_collection_fetch(&api, collection, &resources))
+	{
+		cloud_lock();
+		cloud_collection_update(service, collection, &resources);
+		cloud_unlock();
+	}
+	else
+	{
+		zabbix_log(LOG_LEVEL_DEBUG, "cannot fetch %s list of \"%s\": %s", cloud_collections[collection].name,
+				url, deltacloud_get_last_error_string());
+	}
+
+	deltacloud_free(&api);
+
+	for (i = 0; i < resources.values_num; i++)
+	{
+		cloud_resource_clear(resources.values[i], ZBX_DEFAULT_MEM_FREE_FUNC);
+		zbx_free(resources.values[i]);
+	}
+
+	zbx_vector_ptr_destroy(&resources);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_breaker_allow                                      *
+ *                                                                            *
+ * Purpose: check if the service may be refreshed                             *
+ *                                                                            *
+ * Return value: SUCCEED - the circuit breaker is closed or lets a probe      *
+ *                         through                                            *
+ *               FAIL - the circuit breaker is open                           *
+ *                                                                            *
+ * Comment: the breaker opens after BreakerThreshold consecutive failed       *
+ *          refreshes, then only one refresh per BreakerProbeInterval is let  *
+ *          through until one succeeds. Must be called with the cache locked. *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_breaker_allow(zbx_deltacloud_service_t *service, int now)
+{
+	if (0 == CONFIG_BREAKER_THRESHOLD || service->failures < CONFIG_BREAKER_THRESHOLD)
+		return SUCCEED;
+
+	if (now < service->probe_time)
+		return FAIL;
+
+	/* other pollers must not probe at the same time */
+	service->probe_time = now + CONFIG_BREAKER_PROBE_INTERVAL;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_breaker_update                                     *
+ *                                                                            *
+ * Purpose: record result of a service refresh                                *
+ *                                                                            *
+ * Comment: must be called with the cache locked                              *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_service_breaker_update(zbx_deltacloud_service_t *service, int ret, int now)
+{
+	if (SUCCEED == ret)
+	{
+		if (0 != CONFIG_BREAKER_THRESHOLD && service->failures >= CONFIG_BREAKER_THRESHOLD)
+			zabbix_log(LOG_LEVEL_WARNING, "service \"%s\" is available again", service->url);
+
+		service->failures = 0;
+		return;
+	}
+
+	service->failures++;
+
+	if (0 == CONFIG_BREAKER_THRESHOLD || service->failures < CONFIG_BREAKER_THRESHOLD)
+		return;
+
+	if (service->failures == CONFIG_BREAKER_THRESHOLD)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "service \"%s\" failed %d times, refreshing it every %d seconds only",
+				service->url, service->failures, CONFIG_BREAKER_PROBE_INTERVAL);
+	}
+
+	service->probe_time = now + CONFIG_BREAKER_PROBE_INTERVAL;
+}
+
+/* fleet sample state of the instance state */
+static int	cloud_fleet_state(const char *state)
+{
+	int	i;
+
+	if (NULL == state)
+		return CLOUD_FLEET_OTHER;
+
+	for (i = 0; i < CLOUD_FLEET_OTHER; i++)
+	{
+		if (0 == strcasecmp(cloud_fleet_values[i], state))
+			return i;
+	}
+
+	return CLOUD_FLEET_OTHER;
+}
+
+/* free the fleet samples of the service */
+static void	cloud_fleet_release(zbx_deltacloud_service_t *service, int data)
+{
+	ZBX_UNUSED(data);
+
+	if (NULL == service->fleet)
+		return;
+
+	__cloud_mem_free_func(service->fleet);
+	service->fleet = NULL;
+	service->fleet_size = 0;
+	service->fleet_num = 0;
+	service->fleet_next = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_fleet_sample_add                                           *
+ *                                                                            *
+ * Purpose: record the instances of the service cached by a refresh           *
+ *                                                                            *
+ * Parameters: service  - the service                                         *
+ *             clock    - time of the refresh                                 *
+ *             duration - seconds the refresh took                            *
+ *                                                                            *
+ * Comment: the ring buffer of FleetSamples samples is allocated by the first *
+ *          sample and the oldest sample is overwritten when it is full.      *
+ *          Must be called with the cache locked.                             *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_fleet_sample_add(zbx_deltacloud_service_t *service, int clock, double duration)
+{
+	int				i;
+	zbx_cloud_fleet_sample_t	*sample;
+	zbx_cloud_mem_estimate_t	estimate;
+	zbx_uint64_t			used_size, old_size;
+
+	if (0 == CONFIG_FLEET_SAMPLES)
+		return;
+
+	/* the samples are dropped if another agent sharing the cache has a different FleetSamples */
+	if (service->fleet_size != CONFIG_FLEET_SAMPLES)
+	{
+		memset(&estimate, 0, sizeof(estimate));
+		cloud_mem_estimate_add(&estimate, CONFIG_FLEET_SAMPLES * sizeof(zbx_cloud_fleet_sample_t));
+		old_size = cloud_mem_size(service->fleet);
+
+		if (SUCCEED != cloud_service_mem_reserve(service, old_size, &estimate, "fleet samples") ||
+				SUCCEED != cloud_service_mem_fit(service, old_size, &estimate, cloud_fleet_release, 0,
+				"fleet samples"))
+		{
+			return;
+		}
+
+		used_size = cloud_mem->used_size;
+
+		cloud_fleet_release(service, 0);
+
+		service->fleet = __cloud_mem_malloc_func(NULL, CONFIG_FLEET_SAMPLES * sizeof(zbx_cloud_fleet_sample_t));
+		service->fleet_size = CONFIG_FLEET_SAMPLES;
+		service->fleet_num = 0;
+		service->fleet_next = 0;
+
+		service->mem_used += cloud_mem->used_size - used_size;
+	}
+
+	sample = &service->fleet[service->fleet_next];
+	memset(sample, 0, sizeof(zbx_cloud_fleet_sample_t));
+	sample->clock = clock;
+	sample->total = service->instances.values_num;
+	sample->duration = duration;
+
+	for (i = 0; i < service->instances.values_num; i++)
+		sample->states[cloud_fleet_state(((zbx_deltacloud_instance_t *)service->instances.values[i])->state)]++;
+
+	service->fleet_next = (service->fleet_next + 1) % service->fleet_size;
+
+	if (service->fleet_num < service->fleet_size)
+		service->fleet_num++;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_refresh                                            *
+ *                                                                            *
+ * Purpose: fetch instances of the service and replace the cached ones        *
+ *                                                                            *
+ * Return value: SUCCEED - instances were fetched and cached                  *
+ *               FAIL - the API call failed or the instances exceed the       *
+ *                      memory limit of the service, the cached instances     *
+ *                      are kept                                              *
+ *                                                                            *
+ * Comment: must be called with the cache unlocked, the API is queried        *
+ *          without holding the lock so that other items keep reading the     *
+ *          previous instances meanwhile.                                     *
+ *          The instances are updated after the other collections so that     *
+ *          joined attributes of new instances resolve.                       *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_service_refresh(zbx_deltacloud_service_t *service, char *url, char *key, char *secret, char *driver,
+		char *provider)
+{
+	int				i, ret = SUCCEED, stored = SUCCEED;
+	double				start;
+	pid_t				pids[CLOUD_COLLECTION_COUNT];
+	sigset_t			orig_mask;
+	struct deltacloud_api		api;
+	struct deltacloud_instance	*instances = NULL;
+
+	start = zbx_time();
+
+	cloud_sigchld_block(&orig_mask);
+
+	/* other collections are fetched concurrently by child processes, each of them updates its own table */
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+	{
+		if (1 != CONFIG_REFRESH_COLLECTIONS)
+		{
+			pids[i] = -1;
+			continue;
+		}
+
+		if (0 == (pids[i] = fork()))
+		{
+			cloud_sigchld_child(&orig_mask);
+			cloud_collection_refresh(service, i, url, key, secret, driver, provider);
+			_exit(EXIT_SUCCESS);
+		}
+
+		if (-1 == pids[i])
+		{
+			zabbix_log(LOG_LEVEL_DEBUG, "cannot fork to fetch %s list: %s", cloud_collections[i].name,
+					zbx_strerror(errno));
+			cloud_collection_refresh(service, i, url, key, secret, driver, provider);
+		}
+	}
+
+	if (0 > deltacloud_initialize(&api, url, key, secret, driver, provider) ||
+			0 > deltacloud_get_instances(&api, &instances))
+	{
+		zabbix_log(LOG_LEVEL_DEBUG, "cannot fetch instances of \"%s\": %s", url,
+				deltacloud_get_last_error_string());
+		ret = FAIL;
+	}
+
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+	{
+		if (0 < pids[i])
+			waitpid(pids[i], NULL, 0);
+	}
+
+	cloud_sigchld_unblock(&orig_mask);
+
+	cloud_lock();
+
+	/* a failed fetch keeps the previous instances and their state histories */
+	if (SUCCEED != ret)
+		stored = FAIL;
+	/* the API works even if the instances do not fit, the breaker must not open */
+	else if (SUCCEED != cloud_service_update_instances(service, instances))
+		stored = FAIL;
+	else
+		cloud_fleet_sample_add(service, time(NULL), zbx_time() - start);
+
+	cloud_service_breaker_update(service, ret, time(NULL));
+	cloud_cache_compact_auto();
+	cloud_unlock();
+
+	deltacloud_free(&api);
+
+	/* a fleet without instances is a successful fetch as well */
+	if (NULL != instances)
+		deltacloud_free_instance_list(&instances);
+
+	return stored;
+}
+
+int	zbx_module_cloud_monitor(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	char	*url;
+	char	*key;
+	char	*secret;
+	char	*driver;
+	char	*provider;
+	int	now;
+	zbx_deltacloud_service_t	*service = NULL;
+
+	if (request->nparam != 5)
+	{
+		/* set optional error message */
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.monitor[url, key, secret, driver, provider]"));
+		return SYSINFO_RET_FAIL;
+	}
+	url = get_rparam(request, 0);
+	key = get_rparam(request, 1);
+	secret = get_rparam(request, 2);
+	driver = get_rparam(request, 3);
+	provider = get_rparam(request, 4);
+
+	now = time(NULL);
+
+	cloud_lock();
+
+	if (NULL == (service = zbx_deltacloud_get_service(url, key, secret, driver, provider)))
+	{
+		cloud_unlock();
+		SET_MSG_RESULT(result, strdup("No Data"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	/* the service was refreshed recently by another poller or another agent using this cache */
+	if (0 != CONFIG_REFRESH_INTERVAL && 0 != service->lastcheck && now - service->lastcheck < CONFIG_REFRESH_INTERVAL)
+	{
+		cloud_unlock();
+		SET_UI64_RESULT(result, 0 != service->instances.values_num ? 1 : 0);
+		return SYSINFO_RET_OK;
+	}
+
+	/* the service keeps failing, do not wait for its timeouts on every poll */
+	if (SUCCEED != cloud_service_breaker_allow(service, now))
+	{
+		cloud_unlock();
+		SET_UI64_RESULT(result, 0);
+		return SYSINFO_RET_OK;
+	}
+
+	service->lastcheck = now;
+
+	cloud_unlock();
+
+	SET_UI64_RESULT(result, SUCCEED == cloud_service_refresh(service, url, key, secret, driver, provider) ? 1 : 0);
+	return SYSINFO_RET_OK;
+}
+
+int	zbx_module_cloud_instance_status(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		SET_STR_RESULT(result, strdup(instance->state));
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+/* seconds since the instance entered its state, or since it was first seen in it */
+int	zbx_module_cloud_instance_state_age(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL, now;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		now = time(NULL);
+		SET_UI64_RESULT(result, now > instance->history.since ? now - instance->history.since : 0);
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_instance_state_changes                          *
+ *                                                                            *
+ * Purpose: number of state changes of the instance within the last           *
+ *          StateChangesWindow seconds                                        *
+ *                                                                            *
+ * Comment: only the last CLOUD_STATE_CHANGES_MAX changes are kept, so the    *
+ *          value does not grow above it                                      *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_instance_state_changes(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				i, ret = SYSINFO_RET_FAIL, changes = 0, from;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		from = time(NULL) - CONFIG_STATE_CHANGES_WINDOW;
+
+		for (i = 0; i < instance->history.changes_num; i++)
+		{
+			if (instance->history.changes[i] > from)
+				changes++;
+		}
+
+		SET_UI64_RESULT(result, changes);
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+/* attributes returned by the instance lookup items */
+#define CLOUD_INSTANCE_ATTR_ID		0
+#define CLOUD_INSTANCE_ATTR_NAME	1
+#define CLOUD_INSTANCE_ATTR_STATE	2
+#define CLOUD_INSTANCE_ATTR_IMAGE_ID	3
+#define CLOUD_INSTANCE_ATTR_REALM_ID	4
+#define CLOUD_INSTANCE_ATTR_HWP_ID	5
+
+static const char	*cloud_instance_attributes[] = {"id", "name", "state", "image_id", "realm_id", "hwp_id", NULL};
+
+static const char	*cloud_instance_attribute(const zbx_deltacloud_service_t *service,
+		const zbx_deltacloud_instance_t *instance, int attribute)
+{
+	const zbx_deltacloud_hardware_profile_t	*hwp;
+
+	switch (attribute)
+	{
+		case CLOUD_INSTANCE_ATTR_ID:
+			return instance->id;
+		case CLOUD_INSTANCE_ATTR_NAME:
+			return instance->name;
+		case CLOUD_INSTANCE_ATTR_STATE:
+			return instance->state;
+		case CLOUD_INSTANCE_ATTR_IMAGE_ID:
+			return instance->image_id;
+		case CLOUD_INSTANCE_ATTR_REALM_ID:
+			return instance->realm_id;
+		case CLOUD_INSTANCE_ATTR_HWP_ID:
+			return NULL != (hwp = cloud_instance_hardware_profile(service, instance)) ? hwp->id : NULL;
+		default:
+			return NULL;
+	}
+}
+
+static void	cloud_json_addaddresses(struct zbx_json *json, const char *name, const zbx_vector_ptr_t *addresses)
+{
+	int	i;
+
+	zbx_json_addarray(json, name);
+
+	for (i = 0; i < addresses->values_num; i++)
+	{
+		zbx_json_addstring(json, NULL, ((zbx_deltacloud_address_t *)addresses->values[i])->address,
+				ZBX_JSON_TYPE_STRING);
+	}
+
+	zbx_json_close(json);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_lookup                                            *
+ *                                                                            *
+ * Purpose: find the instance by its name or address and return its           *
+ *          attributes                                                        *
+ *                                                                            *
+ * Parameters: request - item[url, key, secret, driver, provider, name or     *
+ *                       address, <attribute>]                                *
+ *             result  - the attribute or a JSON object of all attributes     *
+ *             by_addr - 1 to look up by address, 0 by name                   *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - the instance was found                      *
+ *               SYSINFO_RET_FAIL - otherwise                                 *
+ *                                                                            *
+ * Comment: the indexes of the snapshot take constant time regardless of the  *
+ *          number of instances. An instance name or address shared by        *
+ *          several instances finds the first of them.                        *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_instance_lookup(AGENT_REQUEST *request, AGENT_RESULT *result, int by_addr)
+{
+	int				attribute = -1, ret = SYSINFO_RET_FAIL;
+	const char			*param, *value;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+	struct zbx_json			json;
+
+	if (request->nparam != 6 && request->nparam != 7)
+	{
+		/* set optional error message */
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid number of parameters e.g.) %s[url, key, secret, driver, provider, %s, <attribute>]",
+				request->key, 1 == by_addr ? "address" : "name"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (7 == request->nparam && '\0' != *(param = get_rparam(request, 6)))
+	{
+		for (attribute = 0; NULL != cloud_instance_attributes[attribute]; attribute++)
+		{
+			if (0 == strcmp(cloud_instance_attributes[attribute], param))
+				break;
+		}
+
+		if (NULL == cloud_instance_attributes[attribute])
+		{
+			SET_MSG_RESULT(result, strdup("Invalid seventh parameter"));
+			return SYSINFO_RET_FAIL;
+		}
+	}
+
+	if (NULL == (service = cloud_instance_service_get(request, CONFIG_LOCAL_VIEW)))
+	{
+		SET_MSG_RESULT(result, strdup("No Data"));
+	}
+	else if (NULL == (instance = cloud_instance_index_find(service, 1 == by_addr ? &service->addr_index :
+			&service->name_index, get_rparam(request, 5))))
+	{
+		SET_MSG_RESULT(result, strdup("Not match data"));
+	}
+	else if (-1 != attribute)
+	{
+		if (NULL != (value = cloud_instance_attribute(service, instance, attribute)))
+		{
+			SET_STR_RESULT(result, strdup(value));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No Data"));
+	}
+	else
+	{
+		zbx_json_init(&json, ZBX_JSON_STAT_BUF_LEN);
+
+		for (attribute = 0; NULL != cloud_instance_attributes[attribute]; attribute++)
+		{
+			if (NULL != (value = cloud_instance_attribute(service, instance, attribute)))
+			{
+				zbx_json_addstring(&json, cloud_instance_attributes[attribute], value,
+						ZBX_JSON_TYPE_STRING);
+			}
+		}
+
+		cloud_json_addaddresses(&json, "public_addresses", &instance->public_addresses);
+		cloud_json_addaddresses(&json, "private_addresses", &instance->private_addresses);
+
+		SET_STR_RESULT(result, strdup(json.buffer));
+		zbx_json_free(&json);
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_by_addr(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_lookup(request, result, 1);
+}
+
+int	zbx_module_cloud_instance_by_name(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_lookup(request, result, 0);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_cold_get                                          *
+ *                                                                            *
+ * Purpose: get a cold attribute of the requested instance                    *
+ *                                                                            *
+ * Parameters: request - item request                                         *
+ *             result  - the attribute value or error message                 *
+ *             offset  - offset of the attribute in                           *
+ *                       zbx_deltacloud_instance_cold_t                       *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - the attribute was found                     *
+ *               SYSINFO_RET_FAIL - otherwise                                 *
+ *                                                                            *
+ * Comment: cold attributes are stored only while they are read. When they    *
+ *          are missing the instance is fetched from the API without holding  *
+ *          the lock and the fetched attributes are attached to the cached    *
+ *          instance, so later reads are served from the cache and the next   *
+ *          refreshes keep storing them.                                      *
+ *          The shared cache is used even with LocalView enabled, because     *
+ *          reads record the demand in the shared service.                    *
+ *          The fetch goes through the circuit breaker of the service, while  *
+ *          it is open a missing attribute fails at once.                     *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_instance_cold_get(AGENT_REQUEST *request, AGENT_RESULT *result, size_t offset)
+{
+	int				now, fetched_ret = FAIL, ret = SYSINFO_RET_FAIL;
+	char				*instance_id;
+	const char			*value;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+	zbx_deltacloud_instance_cold_t	cold;
+	zbx_cloud_mem_estimate_t	estimate;
+	zbx_uint64_t			used_size;
+	struct deltacloud_api		api;
+	struct deltacloud_instance	fetched;
+
+	if (NULL == (instance = cloud_instance_get_ext(request, result, &service, 0)))
+	{
+		cloud_instance_release();
+		return SYSINFO_RET_FAIL;
+	}
+
+	now = time(NULL);
+	service->cold_demand = now;
+
+	if (NULL != instance->cold)
+	{
+		if (NULL != (value = *(char **)((char *)instance->cold + offset)))
+		{
+			SET_STR_RESULT(result, strdup(value));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No Data"));
+
+		cloud_instance_release();
+
+		return ret;
+	}
+
+	/* the service keeps failing, do not wait for its timeouts on every read */
+	if (SUCCEED != cloud_service_breaker_allow(service, now))
+	{
+		cloud_instance_release();
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Service \"%s\" is not available", service->url));
+		return SYSINFO_RET_FAIL;
+	}
+
+	cloud_instance_release();
+
+	instance_id = get_rparam(request, 5);
+
+	if (0 > deltacloud_initialize(&api, get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4)))
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot initialize API: %s",
+				deltacloud_get_last_error_string()));
+	}
+	else if (0 > deltacloud_get_instance_by_id(&api, instance_id, &fetched))
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot fetch instance \"%s\": %s", instance_id,
+				deltacloud_get_last_error_string()));
+	}
+	else
+	{
+		fetched_ret = SUCCEED;
+
+		cloud_instance_cold_set(&cold, &fetched);
+
+		if (NULL != (value = *(char **)((char *)&cold + offset)))
+		{
+			SET_STR_RESULT(result, strdup(value));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No Data"));
+
+		memset(&estimate, 0, sizeof(zbx_cloud_mem_estimate_t));
+		cloud_mem_estimate_add(&estimate, sizeof(zbx_deltacloud_instance_cold_t));
+		cloud_mem_estimate_str(&estimate, cold.href);
+		cloud_mem_estimate_str(&estimate, cold.owner_id);
+		cloud_mem_estimate_str(&estimate, cold.image_href);
+		cloud_mem_estimate_str(&estimate, cold.realm_href);
+		cloud_mem_estimate_str(&estimate, cold.launch_time);
+	}
+
+	/* the instance may have been replaced by a refresh or moved by a compaction meanwhile, */
+	/* services are never moved                                                             */
+	cloud_lock();
+
+	cloud_service_breaker_update(service, fetched_ret, time(NULL));
+
+	if (SUCCEED == fetched_ret &&
+			SUCCEED == cloud_service_mem_reserve(service, 0, &estimate, "cold attributes") &&
+			SUCCEED == cloud_service_mem_fit(service, 0, &estimate, NULL, 0, "cold attributes") &&
+			NULL != (instance = cloud_instance_index_find(service, &service->id_index, instance_id)) &&
+			NULL == instance->cold)
+	{
+		used_size = cloud_mem->used_size;
+		service->generation++;
+		instance->cold = cloud_instance_cold_copy(&cold, __cloud_mem_malloc_func);
+		service->generation++;
+		service->mem_used += cloud_mem->used_size - used_size;
+	}
+
+	cloud_unlock();
+
+	if (SUCCEED == fetched_ret)
+		deltacloud_free_instance(&fetched);
+
+	deltacloud_free(&api);
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_owner_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_cold_get(request, result, offsetof(zbx_deltacloud_instance_cold_t, owner_id));
+}
+
+int	zbx_module_cloud_instance_image_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		SET_STR_RESULT(result, strdup(instance->image_id));
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_image_href(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_cold_get(request, result, offsetof(zbx_deltacloud_instance_cold_t, image_href));
+}
+
+int	zbx_module_cloud_instance_realm_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		SET_STR_RESULT(result, strdup(instance->realm_id));
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_realm_href(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_cold_get(request, result, offsetof(zbx_deltacloud_instance_cold_t, realm_href));
+}
+
+int	zbx_module_cloud_instance_launch_time(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_instance_cold_get(request, result, offsetof(zbx_deltacloud_instance_cold_t, launch_time));
+}
+
+int	zbx_module_cloud_instance_hwp_href(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)) && NULL != hwp->href)
+		{
+			SET_STR_RESULT(result, strdup(hwp->href));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)))
+		{
+			SET_STR_RESULT(result, strdup(hwp->id));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_name(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)) && NULL != hwp->name)
+		{
+			SET_STR_RESULT(result, strdup(hwp->name));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_cpu(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)))
+		{
+			SET_DBL_RESULT(result, hwp->cpu);
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_memory(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)))
+		{
+			SET_UI64_RESULT(result, hwp->memory);
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_storage(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)))
+		{
+			SET_UI64_RESULT(result, hwp->storage);
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_hwp_architecture(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int					ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t		*service;
+	zbx_deltacloud_instance_t		*instance;
+	zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+	{
+		if (NULL != (hwp = cloud_instance_hardware_profile(service, instance)) && NULL != hwp->architecture)
+		{
+			SET_STR_RESULT(result, strdup(hwp->architecture));
+			ret = SYSINFO_RET_OK;
+		}
+		else
+			SET_MSG_RESULT(result, strdup("No hardware profile data"));
+	}
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_instance_resource_name                                     *
+ *                                                                            *
+ * Purpose: resolve name of a resource the instance refers to                 *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_instance_resource_name(AGENT_RESULT *result, zbx_deltacloud_service_t *service, int collection,
+		const char *id)
+{
+	zbx_deltacloud_resource_t	*resource;
+
+	if (NULL == (resource = cloud_resource_find(service, collection, id)) || NULL == resource->values[2])
+	{
+		SET_MSG_RESULT(result, strdup("Not match data"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_STR_RESULT(result, strdup(resource->values[2]));
+	return SYSINFO_RET_OK;
+}
+
+int	zbx_module_cloud_instance_image_name(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+		ret = cloud_instance_resource_name(result, service, CLOUD_COLLECTION_IMAGES, instance->image_id);
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+int	zbx_module_cloud_instance_realm_name(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_instance_t	*instance;
+
+	if (NULL != (instance = cloud_instance_get(request, result, &service)))
+		ret = cloud_instance_resource_name(result, service, CLOUD_COLLECTION_REALMS, instance->realm_id);
+
+	cloud_instance_release();
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_list                                            *
+ *                                                                            *
+ * Purpose: low level discovery of a cached collection                        *
+ *          item[url, key, secret, driver, provider]                          *
+ *                                                                            *
+ * Return value: JSON with {#<COLLECTION>.ID} and {#<COLLECTION>.NAME} macros *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_collection_list(AGENT_REQUEST *request, AGENT_RESULT *result, int collection)
+{
+	const zbx_cloud_collection_t	*desc = &cloud_collections[collection];
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_resource_t	*resource;
+	zbx_hashset_iter_t		iter;
+	struct zbx_json			json;
+	char				macro[MAX_STRING_LEN];
 
 	if (request->nparam != 5)
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid number of parameters e.g.) %s[url, key, secret, driver, provider]",
+				request->key));
+		return SYSINFO_RET_FAIL;
+	}
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+
+	if (NULL == service)
+	{
+		cloud_unlock();
+		SET_MSG_RESULT(result, strdup("No Data"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	zbx_json_init(&json, ZBX_JSON_STAT_BUF_LEN);
+	zbx_json_addarray(&json, ZBX_PROTO_TAG_DATA);
+
+	zbx_hashset_iter_reset(&service->collections[collection], &iter);
+
+	while (NULL != (resource = zbx_hashset_iter_next(&iter)))
+	{
+		zbx_json_addobject(&json, NULL);
+
+		zbx_snprintf(macro, sizeof(macro), "{#%s.ID}", desc->macro);
+		zbx_json_addstring(&json, macro, resource->values[0], ZBX_JSON_TYPE_STRING);
+
+		if (NULL != resource->values[2])
+		{
+			zbx_snprintf(macro, sizeof(macro), "{#%s.NAME}", desc->macro);
+			zbx_json_addstring(&json, macro, resource->values[2], ZBX_JSON_TYPE_STRING);
+		}
+
+		zbx_json_close(&json);
+	}
+
+	cloud_unlock();
+
+	SET_STR_RESULT(result, strdup(json.buffer));
+	zbx_json_free(&json);
+
+	return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_collection_get                                             *
+ *                                                                            *
+ * Purpose: get a field of a cached collection resource                       *
+ *          item[url, key, secret, driver, provider, id, <field>]             *
+ *                                                                            *
+ * Comment: field defaults to name, sizes are returned in bytes               *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_collection_get(AGENT_REQUEST *request, AGENT_RESULT *result, int collection)
+{
+	const zbx_cloud_collection_t	*desc = &cloud_collections[collection];
+	int				field, ret = SYSINFO_RET_FAIL;
+	const char			*name;
+	zbx_deltacloud_service_t	*service;
+	zbx_deltacloud_resource_t	*resource;
+
+	if (request->nparam != 6 && request->nparam != 7)
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid number of parameters e.g.) %s[url, key, secret, driver, provider, %s_id, <field>]",
+				request->key, desc->name));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (7 != request->nparam || NULL == (name = get_rparam(request, 6)) || '\0' == *name)
+		name = "name";
+
+	for (field = 0; NULL != desc->fields[field]; field++)
+	{
+		if (0 == strcmp(desc->fields[field], name))
+			break;
+	}
+
+	if (NULL == desc->fields[field])
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Unsupported %s field \"%s\"", desc->name, name));
+		return SYSINFO_RET_FAIL;
+	}
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+
+	if (NULL == service)
+		SET_MSG_RESULT(result, strdup("No Data"));
+	else if (NULL == (resource = cloud_resource_find(service, collection, get_rparam(request, 5))))
+		SET_MSG_RESULT(result, strdup("Not match data"));
+	else if (NULL == resource->values[field])
+		SET_MSG_RESULT(result, strdup("No Data"));
+	else
+	{
+		SET_STR_RESULT(result, strdup(resource->values[field]));
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_unlock();
+
+	return ret;
+}
+
+int	zbx_module_cloud_image_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_list(request, result, CLOUD_COLLECTION_IMAGES);
+}
+
+int	zbx_module_cloud_image_get(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_get(request, result, CLOUD_COLLECTION_IMAGES);
+}
+
+int	zbx_module_cloud_realm_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_list(request, result, CLOUD_COLLECTION_REALMS);
+}
+
+int	zbx_module_cloud_realm_get(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_get(request, result, CLOUD_COLLECTION_REALMS);
+}
+
+int	zbx_module_cloud_hwp_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_list(request, result, CLOUD_COLLECTION_HARDWARE_PROFILES);
+}
+
+int	zbx_module_cloud_hwp_get(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_get(request, result, CLOUD_COLLECTION_HARDWARE_PROFILES);
+}
+
+int	zbx_module_cloud_volume_list(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_list(request, result, CLOUD_COLLECTION_STORAGE_VOLUMES);
+}
+
+int	zbx_module_cloud_volume_get(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	return cloud_collection_get(request, result, CLOUD_COLLECTION_STORAGE_VOLUMES);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_service_memory                                  *
+ *                                                                            *
+ * Purpose: shared cache memory of a service                                  *
+ *          cloud.service.memory[url, key, secret, driver, provider, <mode>]  *
+ *                                                                            *
+ * Comment: modes: used - bytes taken by the service (default)                *
+ *                 limit - memory limit of the service, 0 if unlimited        *
+ *                 pused - used bytes in percent of the limit                 *
+ *                 overflows - refreshes discarded because of the limit or    *
+ *                             because the cache was full                     *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_service_memory(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_OK;
+	char				*mode;
+	zbx_uint64_t			limit;
+	zbx_deltacloud_service_t	*service;
+
+	if (5 != request->nparam && 6 != request->nparam)
+	{
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.service.memory[url, key, secret, driver, provider, <mode>]"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	mode = get_rparam(request, 5);
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+
+	if (NULL == service)
+	{
+		SET_MSG_RESULT(result, strdup("No Data"));
+		ret = SYSINFO_RET_FAIL;
+	}
+	else if (NULL == mode || '\0' == *mode || 0 == strcmp(mode, "used"))
+	{
+		SET_UI64_RESULT(result, service->mem_used);
+	}
+	else if (0 == strcmp(mode, "limit"))
+	{
+		SET_UI64_RESULT(result, cloud_service_mem_limit(service));
+	}
+	else if (0 == strcmp(mode, "pused"))
+	{
+		if (0 != (limit = cloud_service_mem_limit(service)))
+		{
+			SET_DBL_RESULT(result, 100.0 * service->mem_used / limit);
+		}
+		else
+		{
+			SET_MSG_RESULT(result, strdup("The service has no memory limit"));
+			ret = SYSINFO_RET_FAIL;
+		}
+	}
+	else if (0 == strcmp(mode, "overflows"))
+	{
+		SET_UI64_RESULT(result, service->mem_overflows);
+	}
+	else
+	{
+		SET_MSG_RESULT(result, strdup("Invalid sixth parameter"));
+		ret = SYSINFO_RET_FAIL;
+	}
+
+	cloud_unlock();
+
+	return ret;
+}
+
+/* functions of cloud.fleet.trend */
+#define CLOUD_FLEET_FUNC_MIN	0
+#define CLOUD_FLEET_FUNC_MAX	1
+#define CLOUD_FLEET_FUNC_AVG	2
+#define CLOUD_FLEET_FUNC_RATE	3
+
+static const char	*cloud_fleet_functions[] = {"min", "max", "avg", "rate", NULL};
+
+static double	cloud_fleet_value(const zbx_cloud_fleet_sample_t *sample, int value)
+{
+	switch (value)
+	{
+		case CLOUD_FLEET_TOTAL:
+			return sample->total;
+		case CLOUD_FLEET_DURATION:
+			return sample->duration;
+		default:
+			return sample->states[value];
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_fleet_trend                                                *
+ *                                                                            *
+ * Purpose: calculate a function of a sample value over a time window         *
+ *                                                                            *
+ * Parameters: service  - the service                                         *
+ *             value    - CLOUD_FLEET_* value of the samples                  *
+ *             from     - samples taken after this time are used              *
+ *             function - CLOUD_FLEET_FUNC_*                                  *
+ *             trend    - [OUT] the result, rate is the change per second     *
+ *                        from the oldest to the newest sample                *
+ *                                                                            *
+ * Return value: SUCCEED - the result was calculated                          *
+ *               FAIL - there are no samples in the window, or less than two  *
+ *                      for rate                                              *
+ *                                                                            *
+ * Comment: only the samples within the window are visited, from the newest.  *
+ *          Must be called with the cache locked.                             *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_fleet_trend(const zbx_deltacloud_service_t *service, int value, int from, int function,
+		double *trend)
+{
+	int				i, num = 0;
+	double				sample_value, min = 0, max = 0, sum = 0;
+	const zbx_cloud_fleet_sample_t	*sample, *newest = NULL, *oldest = NULL;
+
+	for (i = 1; i <= service->fleet_num; i++)
+	{
+		sample = &service->fleet[(service->fleet_next - i + service->fleet_size) % service->fleet_size];
+
+		if (sample->clock <= from)
+			break;
+
+		sample_value = cloud_fleet_value(sample, value);
+
+		if (0 == num++)
+		{
+			newest = sample;
+			min = max = sample_value;
+		}
+		else if (sample_value < min)
+			min = sample_value;
+		else if (sample_value > max)
+			max = sample_value;
+
+		sum += sample_value;
+		oldest = sample;
+	}
+
+	if (0 == num)
+		return FAIL;
+
+	switch (function)
+	{
+		case CLOUD_FLEET_FUNC_MIN:
+			*trend = min;
+			break;
+		case CLOUD_FLEET_FUNC_MAX:
+			*trend = max;
+			break;
+		case CLOUD_FLEET_FUNC_AVG:
+			*trend = sum / num;
+			break;
+		default:
+			if (newest->clock == oldest->clock)
+				return FAIL;
+
+			*trend = (cloud_fleet_value(newest, value) - cloud_fleet_value(oldest, value)) /
+					(newest->clock - oldest->clock);
+	}
+
+	return SUCCEED;
+}
+
+/* find the parameter in the list of names, returns its position or FAIL */
+static int	cloud_param_index(const char *param, const char **names)
+{
+	int	i;
+
+	for (i = 0; NULL != names[i]; i++)
+	{
+		if (0 == strcmp(names[i], param))
+			return i;
+	}
+
+	return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_fleet_trend                                     *
+ *                                                                            *
+ * Purpose: return a trend of the instances recorded by the last refreshes    *
+ *                                                                            *
+ * Parameters: request - cloud.fleet.trend[url, key, secret, driver,          *
+ *                       provider, <value>, <window>, <function>]             *
+ *                       value    - total (default), a state or duration      *
+ *                       window   - seconds or with a time suffix, 1h default *
+ *                       function - min, max, avg (default) or rate           *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - the trend is returned                       *
+ *               SYSINFO_RET_FAIL - invalid parameters or not enough samples  *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_fleet_trend(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				ret = SYSINFO_RET_FAIL, value = CLOUD_FLEET_TOTAL, window = SEC_PER_HOUR,
+					function = CLOUD_FLEET_FUNC_AVG;
+	char				*param;
+	double				trend;
+	zbx_deltacloud_service_t	*service;
+
+	if (5 > request->nparam || 8 < request->nparam)
+	{
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.fleet.trend[url, key, secret, driver, provider, <value>, <window>, <function>]"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (NULL != (param = get_rparam(request, 5)) && '\0' != *param &&
+			FAIL == (value = cloud_param_index(param, cloud_fleet_values)))
+	{
+		SET_MSG_RESULT(result, strdup("Invalid sixth parameter"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (NULL != (param = get_rparam(request, 6)) && '\0' != *param &&
+			(SUCCEED != is_time_suffix(param, &window) || 0 == window))
+	{
+		SET_MSG_RESULT(result, strdup("Invalid seventh parameter"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (NULL != (param = get_rparam(request, 7)) && '\0' != *param &&
+			FAIL == (function = cloud_param_index(param, cloud_fleet_functions)))
+	{
+		SET_MSG_RESULT(result, strdup("Invalid eighth parameter"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	cloud_lock();
+
+	service = zbx_deltacloud_get_service(get_rparam(request, 0), get_rparam(request, 1), get_rparam(request, 2),
+			get_rparam(request, 3), get_rparam(request, 4));
+
+	if (NULL == service)
+	{
+		SET_MSG_RESULT(result, strdup("No Data"));
+	}
+	else if (SUCCEED != cloud_fleet_trend(service, value, time(NULL) - window, function, &trend))
+	{
+		SET_MSG_RESULT(result, strdup("Not enough samples in the window"));
+	}
+	else
+	{
+		SET_DBL_RESULT(result, trend);
+		ret = SYSINFO_RET_OK;
+	}
+
+	cloud_unlock();
+
+	return ret;
+}
+
+#define CLOUD_SHARED_PTR(ptr)	((void *)(ptr) >= cloud_mem->lo_bound && (void *)(ptr) < cloud_mem->hi_bound)
+
+static int	cloud_cache_check_string(const char *str)
+{
+	if (NULL == str)
+		return SUCCEED;
+
+	if (!CLOUD_SHARED_PTR(str) || NULL == memchr(str, '\0', (char *)cloud_mem->hi_bound - str))
+		return FAIL;
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_vector(const zbx_vector_ptr_t *vector)
+{
+	int	i;
+
+	if (0 > vector->values_num || vector->values_num > vector->values_alloc)
+		return FAIL;
+
+	if (0 != vector->values_alloc && !CLOUD_SHARED_PTR(vector->values))
+		return FAIL;
+
+	for (i = 0; i < vector->values_num; i++)
+	{
+		if (!CLOUD_SHARED_PTR(vector->values[i]))
+			return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_addresses(const zbx_vector_ptr_t *addresses)
+{
+	int	i;
+
+	if (SUCCEED != cloud_cache_check_vector(addresses))
+		return FAIL;
+
+	for (i = 0; i < addresses->values_num; i++)
+	{
+		if (SUCCEED != cloud_cache_check_string(((zbx_deltacloud_address_t *)addresses->values[i])->address))
+			return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_fleet(const zbx_deltacloud_service_t *service)
+{
+	if (NULL == service->fleet)
+		return 0 == service->fleet_size && 0 == service->fleet_num ? SUCCEED : FAIL;
+
+	if (!CLOUD_SHARED_PTR(service->fleet) || 0 >= service->fleet_size || 0 > service->fleet_num ||
+			service->fleet_num > service->fleet_size || 0 > service->fleet_next ||
+			service->fleet_next >= service->fleet_size)
+	{
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_resources(const zbx_hashset_t *resources)
+{
+	int				i, j;
+	const ZBX_HASHSET_ENTRY_T	*entry;
+	const zbx_deltacloud_resource_t	*resource;
+
+	if (0 > resources->num_data || 0 >= resources->num_slots || !CLOUD_SHARED_PTR(resources->slots))
+		return FAIL;
+
+	for (i = 0; i < resources->num_slots; i++)
+	{
+		for (entry = resources->slots[i]; NULL != entry; entry = entry->next)
+		{
+			if (!CLOUD_SHARED_PTR(entry))
+				return FAIL;
+
+			resource = (const zbx_deltacloud_resource_t *)entry->data;
+
+			if (NULL == resource->values[0])
+				return FAIL;
+
+			for (j = 0; j < CLOUD_RESOURCE_FIELDS_MAX; j++)
+			{
+				if (SUCCEED != cloud_cache_check_string(resource->values[j]))
+					return FAIL;
+			}
+		}
+	}
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_index(const zbx_deltacloud_service_t *service, const zbx_hashset_t *index)
+{
+	int				i;
+	const ZBX_HASHSET_ENTRY_T	*entry;
+	const zbx_cloud_instance_ref_t	*ref;
+
+	if (0 > index->num_data || 0 >= index->num_slots || !CLOUD_SHARED_PTR(index->slots))
+		return FAIL;
+
+	for (i = 0; i < index->num_slots; i++)
+	{
+		for (entry = index->slots[i]; NULL != entry; entry = entry->next)
+		{
+			if (!CLOUD_SHARED_PTR(entry))
+				return FAIL;
+
+			ref = (const zbx_cloud_instance_ref_t *)entry->data;
+
+			if (NULL == ref->key || SUCCEED != cloud_cache_check_string(ref->key) || 0 > ref->index ||
+					ref->index >= service->instances.values_num)
+			{
+				return FAIL;
+			}
+		}
+	}
+
+	return SUCCEED;
+}
+
+static int	cloud_cache_check_instance(const zbx_deltacloud_service_t *service, const zbx_deltacloud_instance_t *instance)
+{
+	if (SUCCEED != cloud_cache_check_string(instance->id) || SUCCEED != cloud_cache_check_string(instance->name) ||
+			SUCCEED != cloud_cache_check_string(instance->image_id) ||
+			SUCCEED != cloud_cache_check_string(instance->realm_id) ||
+			SUCCEED != cloud_cache_check_string(instance->state))
+	{
+		return FAIL;
+	}
+
+	if (0 > instance->history.changes_num || CLOUD_STATE_CHANGES_MAX < instance->history.changes_num ||
+			0 > instance->history.changes_next ||
+			CLOUD_STATE_CHANGES_MAX <= instance->history.changes_next)
+	{
+		return FAIL;
+	}
+
+	if (NULL != instance->cold && (!CLOUD_SHARED_PTR(instance->cold) ||
+			SUCCEED != cloud_cache_check_string(instance->cold->href) ||
+			SUCCEED != cloud_cache_check_string(instance->cold->owner_id) ||
+			SUCCEED != cloud_cache_check_string(instance->cold->image_href) ||
+			SUCCEED != cloud_cache_check_string(instance->cold->realm_href) ||
+			SUCCEED != cloud_cache_check_string(instance->cold->launch_time)))
+	{
+		return FAIL;
+	}
+
+	if (-1 > instance->hwp_index || instance->hwp_index >= service->hardware_profiles.values_num)
+		return FAIL;
+
+	if (SUCCEED != cloud_cache_check_addresses(&instance->public_addresses) ||
+			SUCCEED != cloud_cache_check_addresses(&instance->private_addresses))
+	{
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_cache_check                                                *
+ *                                                                            *
+ * Purpose: validate the cache structure                                      *
+ *                                                                            *
+ * Return value: number of inconsistencies found                              *
+ *                                                                            *
+ * Comment: every pointer must point into the shared segment, vectors must be *
+ *          within their allocated size and strings terminated inside the     *
+ *          segment. Must be called with the cache locked.                    *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_cache_check(void)
+{
+	int					i, j, errors = 0, service_errors;
+	zbx_uint64_t				size;
+	const zbx_deltacloud_service_t		*service;
+	const zbx_deltacloud_hardware_profile_t	*hwp;
+
+	if (cloud_mem->used_size > cloud_mem->total_size || cloud_mem->free_size > cloud_mem->total_size)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "cloud cache: invalid allocator sizes used:" ZBX_FS_UI64 " free:" ZBX_FS_UI64
+				" total:" ZBX_FS_UI64, cloud_mem->used_size, cloud_mem->free_size, cloud_mem->total_size);
+		errors++;
+	}
+
+	if (SUCCEED != cloud_cache_check_vector(&deltacloud->services))
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted service list");
+		return ++errors;
+	}
+
+	for (i = 0; i < deltacloud->services.values_num; i++)
+	{
+		service = deltacloud->services.values[i];
+		service_errors = errors;
+
+		if (SUCCEED != cloud_cache_check_string(service->url) || SUCCEED != cloud_cache_check_string(service->key) ||
+				SUCCEED != cloud_cache_check_string(service->secret) ||
+				SUCCEED != cloud_cache_check_string(service->driver) ||
+				SUCCEED != cloud_cache_check_string(service->provider) ||
+				SUCCEED != cloud_cache_check_vector(&service->hardware_profiles) ||
+				SUCCEED != cloud_cache_check_vector(&service->instances) ||
+				SUCCEED != cloud_cache_check_fleet(service) ||
+				0 != (service->generation & 1))
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted service #%d", i);
+			errors++;
+			continue;
+		}
+
+		for (j = 0; j < service->hardware_profiles.values_num; j++)
+		{
+			hwp = service->hardware_profiles.values[j];
+
+			if (SUCCEED != cloud_cache_check_string(hwp->href) || SUCCEED != cloud_cache_check_string(hwp->id) ||
+					SUCCEED != cloud_cache_check_string(hwp->name) ||
+					SUCCEED != cloud_cache_check_string(hwp->architecture))
+			{
+				zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted hardware profile #%d of service \"%s\"",
+						j, service->url);
+				errors++;
+			}
+		}
+
+		for (j = 0; j < CLOUD_COLLECTION_COUNT; j++)
+		{
+			if (SUCCEED != cloud_cache_check_resources(&service->collections[j]))
+			{
+				zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted %s list of service \"%s\"",
+						cloud_collections[j].name, service->url);
+				errors++;
+			}
+		}
+
+		for (j = 0; j < service->instances.values_num; j++)
+		{
+			if (SUCCEED != cloud_cache_check_instance(service, service->instances.values[j]))
+			{
+				zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted instance #%d of service \"%s\"", j,
+						service->url);
+				errors++;
+			}
+		}
+
+		if (SUCCEED != cloud_cache_check_index(service, &service->id_index) ||
+				SUCCEED != cloud_cache_check_index(service, &service->name_index) ||
+				SUCCEED != cloud_cache_check_index(service, &service->addr_index))
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "cloud cache: corrupted instance index of service \"%s\"",
+					service->url);
+			errors++;
+		}
+
+		/* the accounting is verified only on intact services, corrupted pointers cannot be followed */
+		if (errors == service_errors && service->mem_used != (size = cloud_service_mem_size(service)))
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "cloud cache: service \"%s\" accounts " ZBX_FS_UI64 " bytes, but"
+					" takes " ZBX_FS_UI64, service->url, service->mem_used, size);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+int	zbx_module_cloud_cache_check(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int	errors;
+
+	ZBX_UNUSED(request);
+
+	cloud_lock();
+	errors = cloud_cache_check();
+	cloud_unlock();
+
+	SET_UI64_RESULT(result, errors);
+	return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_cache_compact                                              *
+ *                                                                            *
+ * Purpose: defragment the cloud shared segment                               *
+ *                                                                            *
+ * Comment: contents of all services are copied to the heap, freed from the   *
+ *          shared segment and copied back, so that the allocator hands out   *
+ *          the freed space again from the start of the segment and the free  *
+ *          chunks left by the many refreshes merge into one.                 *
+ *          The service structures stay in place because monitor items keep   *
+ *          pointers to them while the cache is unlocked.                     *
+ *          Must be called with the cache locked.                             *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_cache_compact(void)
+{
+	int				i;
+	zbx_deltacloud_service_t	*service, *copies;
+	zbx_uint64_t			used_size;
+
+	if (0 == deltacloud->services.values_num)
+		return;
+
+	copies = zbx_malloc(NULL, sizeof(zbx_deltacloud_service_t) * deltacloud->services.values_num);
+
+	for (i = 0; i < deltacloud->services.values_num; i++)
+	{
+		service = deltacloud->services.values[i];
+		service->generation++;
+		cloud_service_copy(&copies[i], service, ZBX_DEFAULT_MEM_MALLOC_FUNC, ZBX_DEFAULT_MEM_REALLOC_FUNC,
+				ZBX_DEFAULT_MEM_FREE_FUNC);
+		used_size = cloud_mem->used_size;
+		cloud_service_clear(service, __cloud_mem_free_func);
+		copies[i].mem_used -= used_size - cloud_mem->used_size;
+	}
+
+	for (i = 0; i < deltacloud->services.values_num; i++)
+	{
+		service = deltacloud->services.values[i];
+		used_size = cloud_mem->used_size;
+		cloud_service_copy(service, &copies[i], __cloud_mem_malloc_func, __cloud_mem_realloc_func,
+				__cloud_mem_free_func);
+		service->mem_used += cloud_mem->used_size - used_size;
+		service->generation++;
+		cloud_service_clear(&copies[i], ZBX_DEFAULT_MEM_FREE_FUNC);
+	}
+
+	zbx_free(copies);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_cache_compact_auto                                         *
+ *                                                                            *
+ * Purpose: compact the cloud shared segment when its fragmentation exceeds   *
+ *          CompactionThreshold                                               *
+ *                                                                            *
+ * Comment: must be called with the cache locked                              *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_cache_compact_auto(void)
+{
+	zbx_cloud_mem_stats_t	before, after;
+
+	if (0 == CONFIG_COMPACTION_THRESHOLD)
+		return;
+
+	cloud_mem_stats(&before);
+
+	if (before.fragmentation <= CONFIG_COMPACTION_THRESHOLD)
+		return;
+
+	cloud_cache_compact();
+	cloud_mem_stats(&after);
+
+	zabbix_log(LOG_LEVEL_INFORMATION, "cloud cache compacted: fragmentation %.1f%% -> %.1f%%, free chunks "
+			ZBX_FS_UI64 " -> " ZBX_FS_UI64 ", largest free chunk " ZBX_FS_UI64 " -> " ZBX_FS_UI64,
+			before.fragmentation, after.fragmentation, before.free_chunks, after.free_chunks,
+			before.largest_free_chunk, after.largest_free_chunk);
+}
+
+static void	cloud_mem_stats_json(struct zbx_json *j, const char *name, const zbx_cloud_mem_stats_t *stats)
+{
+	char	buffer[32];
+
+	zbx_json_addobject(j, name);
+	zbx_json_adduint64(j, "free_size", stats->free_size);
+	zbx_json_adduint64(j, "used_size", stats->used_size);
+	zbx_json_adduint64(j, "free_chunks", stats->free_chunks);
+	zbx_json_adduint64(j, "largest_free_chunk", stats->largest_free_chunk);
+	zbx_snprintf(buffer, sizeof(buffer), "%.2f", stats->fragmentation);
+	zbx_json_addstring(j, "fragmentation", buffer, ZBX_JSON_TYPE_INT);
+	zbx_json_close(j);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_cache_compact                                   *
+ *                                                                            *
+ * Purpose: defragment the cloud shared segment on demand                     *
+ *                                                                            *
+ * Return value: JSON object with the free chunk statistics before and after  *
+ *               the compaction                                               *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_cache_compact(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	zbx_cloud_mem_stats_t	before, after;
+	struct zbx_json		j;
+
+	ZBX_UNUSED(request);
+
+	cloud_lock();
+	cloud_mem_stats(&before);
+	cloud_cache_compact();
+	cloud_mem_stats(&after);
+	cloud_unlock();
+
+	zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+	cloud_mem_stats_json(&j, "before", &before);
+	cloud_mem_stats_json(&j, "after", &after);
+	zbx_json_close(&j);
+
+	SET_TEXT_RESULT(result, strdup(j.buffer));
+	zbx_json_free(&j);
+
+	return SYSINFO_RET_OK;
+}
+
+/* mock backend service used by the stress test, it never contacts any API */
+#define STRESS_URL	"mock://stress"
+#define STRESS_DRIVER	"mock"
+
+typedef struct
+{
+	zbx_uint64_t	reads;
+	zbx_uint64_t	refreshes;
+	zbx_uint64_t	torn_reads;
+	zbx_uint64_t	check_errors;
+	double		refresh_time;
+	double		refresh_time_max;
+	zbx_uint64_t	getter_reads;
+	double		getter_time;
+}
+zbx_cloud_stress_stats_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_mock_instances                                             *
+ *                                                                            *
+ * Purpose: generate instance list as libdeltacloud would return it           *
+ *                                                                            *
+ * Parameters: num   - number of instances                                    *
+ *             round - refresh identifier, all instance ids of one list are   *
+ *                     "<round>-<n>" so a mix of two lists can be detected    *
+ *                                                                            *
+ * Comment: names have random length to exercise the allocator the same way   *
+ *          real fleets do                                                    *
+ *                                                                            *
+ ******************************************************************************/
+static struct deltacloud_instance	*cloud_mock_instances(int num, const char *round)
+{
+	static const char		*states[] = {"RUNNING", "PENDING", "STOPPED"};
+	static const char		*memory[] = {"613", "1740.8", "7680"};
+	struct deltacloud_instance	*instances = NULL, *instance;
+	struct deltacloud_property	*property;
+	int				i, profile;
+
+	for (i = 0; i < num; i++)
+	{
+		profile = rand() % ARRSIZE(memory);
+
+		instance = zbx_malloc(NULL, sizeof(struct deltacloud_instance));
+		memset(instance, 0, sizeof(struct deltacloud_instance));
+
+		instance->id = zbx_dsprintf(NULL, "%s-%d", round, i);
+		instance->href = zbx_dsprintf(NULL, STRESS_URL "/instances/%s", instance->id);
+		instance->name = zbx_dsprintf(NULL, "mock-%.*s", rand() % 64, "0123456789abcdef0123456789abcdef"
+				"0123456789abcdef0123456789abcdef");
+		instance->state = zbx_strdup(NULL, states[rand() % ARRSIZE(states)]);
+		instance->image_id = zbx_dsprintf(NULL, "image-%d", i % 7);
+		instance->realm_id = zbx_dsprintf(NULL, "realm-%d", i % 3);
+		instance->launch_time = zbx_dsprintf(NULL, "%d", (int)time(NULL));
+
+		instance->public_addresses = zbx_malloc(NULL, sizeof(struct deltacloud_address));
+		memset(instance->public_addresses, 0, sizeof(struct deltacloud_address));
+		instance->public_addresses->address = zbx_dsprintf(NULL, "203.0.%d.%d", (i >> 8) & 0xff, i & 0xff);
+
+		instance->private_addresses = zbx_malloc(NULL, sizeof(struct deltacloud_address));
+		memset(instance->private_addresses, 0, sizeof(struct deltacloud_address));
+		instance->private_addresses->address = zbx_dsprintf(NULL, "10.0.%d.%d", (i >> 8) & 0xff, i & 0xff);
+
+		instance->hwp.id = zbx_dsprintf(NULL, "profile-%d", profile);
+
+		property = zbx_malloc(NULL, sizeof(struct deltacloud_property));
+		memset(property, 0, sizeof(struct deltacloud_property));
+		property->name = zbx_strdup(NULL, "memory");
+		property->unit = zbx_strdup(NULL, "MB");
+		property->value = zbx_strdup(NULL, memory[profile]);
+		instance->hwp.properties = property;
+
+		instance->next = instances;
+		instances = instance;
+	}
+
+	return instances;
+}
+
+static void	cloud_mock_instances_free(struct deltacloud_instance *instances)
+{
+	struct deltacloud_instance	*instance;
+
+	while (NULL != (instance = instances))
+	{
+		instances = instance->next;
+
+		zbx_free(instance->hwp.properties->name);
+		zbx_free(instance->hwp.properties->unit);
+		zbx_free(instance->hwp.properties->value);
+		zbx_free(instance->hwp.properties);
+		zbx_free(instance->hwp.id);
+		zbx_free(instance->public_addresses->address);
+		zbx_free(instance->public_addresses);
+		zbx_free(instance->private_addresses->address);
+		zbx_free(instance->private_addresses);
+		zbx_free(instance->id);
+		zbx_free(instance->href);
+		zbx_free(instance->name);
+		zbx_free(instance->state);
+		zbx_free(instance->image_id);
+		zbx_free(instance->realm_id);
+		zbx_free(instance->launch_time);
+		zbx_free(instance);
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_stress_check_round                                         *
+ *                                                                            *
+ * Purpose: check that all instances of the service come from one refresh     *
+ *                                                                            *
+ * Parameters: service - the stress service or its local view                 *
+ *             id      - [OUT] id of a random instance for the getters        *
+ *                                                                            *
+ * Return value: SUCCEED - all instances come from one refresh                *
+ *               FAIL - instances of different refreshes are mixed            *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_stress_check_round(const zbx_deltacloud_service_t *service, char *id, size_t id_len)
+{
+	int				i, ret = SUCCEED;
+	const char			*round = NULL, *sep;
+	size_t				round_len = 0;
+	const zbx_deltacloud_instance_t	*instance;
+
+	for (i = 0; i < service->instances.values_num; i++)
+	{
+		instance = service->instances.values[i];
+
+		if (NULL == instance->id || NULL == (sep = strrchr(instance->id, '-')))
+		{
+			ret = FAIL;
+			break;
+		}
+
+		if (NULL == round)
+		{
+			round = instance->id;
+			round_len = sep - round;
+		}
+		else if ((size_t)(sep - instance->id) != round_len || 0 != strncmp(round, instance->id, round_len))
+		{
+			ret = FAIL;
+			break;
+		}
+	}
+
+	if (0 != service->instances.values_num)
+	{
+		instance = service->instances.values[rand() % service->instances.values_num];
+		zbx_strlcpy(id, NULL != instance->id ? instance->id : "", id_len);
+	}
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_stress_read_snapshot                                       *
+ *                                                                            *
+ * Purpose: check that the stress service is seen in a consistent state       *
+ *                                                                            *
+ * Parameters: service - the stress service                                   *
+ *             id      - [OUT] id of a random instance for the getters        *
+ *             stats   - [OUT] torn reads and check errors are counted here   *
+ *                                                                            *
+ * Comment: with LocalView enabled the local view is checked, it is read      *
+ *          without the lock and a read is torn when it sees instances of     *
+ *          different refreshes. Otherwise the shared service is checked      *
+ *          under the lock, where a change in progress (odd generation) or    *
+ *          mixed refreshes are errors of the cache, not torn reads.          *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_stress_read_snapshot(const zbx_deltacloud_service_t *service, char *id, size_t id_len,
+		zbx_cloud_stress_stats_t *stats)
+{
+	zbx_cloud_view_t	*view;
+
+	if (1 == CONFIG_LOCAL_VIEW)
+	{
+		if (NULL != (view = cloud_view_find(STRESS_URL, "", "", STRESS_DRIVER, "")) &&
+				SUCCEED != cloud_stress_check_round(cloud_view_sync(view), id, id_len))
+		{
+			stats->torn_reads++;
+		}
+
+		return;
+	}
+
+	cloud_lock();
+
+	if (0 != (service->generation & 1) || SUCCEED != cloud_stress_check_round(service, id, id_len))
+		stats->check_errors++;
+
+	if (0 == rand() % 16)
+		stats->check_errors += cloud_cache_check();
+
+	cloud_unlock();
+}
+
+static void	cloud_stress_reader(zbx_deltacloud_service_t *service, double deadline, zbx_cloud_stress_stats_t *stats)
+{
+	char		id[MAX_STRING_LEN] = "", *params[6] = {STRESS_URL, "", "", STRESS_DRIVER, "", id};
+	double		start;
+	AGENT_REQUEST	request;
+	AGENT_RESULT	result;
+
+	memset(&request, 0, sizeof(request));
+	request.params = params;
+
+	while (zbx_time() < deadline)
+	{
+		init_result(&result);
+
+		switch (stats->reads % 3)
+		{
+			case 0:
+				cloud_stress_read_snapshot(service, id, sizeof(id), stats);
+				break;
+			case 1:
+				request.key = "cloud.instance.status";
+				request.nparam = 6;
+				start = zbx_time();
+				zbx_module_cloud_instance_status(&request, &result);
+				stats->getter_time += zbx_time() - start;
+				stats->getter_reads++;
+				break;
+			case 2:
+				request.key = "cloud.instance.list";
+				request.nparam = 5;
+				zbx_module_cloud_instance_list(&request, &result);
+				break;
+		}
+
+		free_result(&result);
+		stats->reads++;
+	}
+}
+
+static void	cloud_stress_writer(zbx_deltacloud_service_t *service, int num, double deadline,
+		zbx_cloud_stress_stats_t *stats)
+{
+	char				round[64];
+	double				start, elapsed;
+	struct deltacloud_instance	*instances;
+
+	while (zbx_time() < deadline)
+	{
+		zbx_snprintf(round, sizeof(round), "%d.%d", (int)getpid(), (int)stats->refreshes);
+		instances = cloud_mock_instances(num, round);
+
+		start = zbx_time();
+		cloud_lock();
+		cloud_service_update_instances(service, instances);
+		cloud_unlock();
+		elapsed = zbx_time() - start;
+
+		stats->refreshes++;
+		stats->refresh_time += elapsed;
+
+		if (elapsed > stats->refresh_time_max)
+			stats->refresh_time_max = elapsed;
+
+		cloud_mock_instances_free(instances);
+	}
+}
+
+static int	cloud_int_param(AGENT_REQUEST *request, int index, int default_value)
+{
+	char	*param;
+
+	if (NULL == (param = get_rparam(request, index)) || '\0' == *param)
+		return default_value;
+
+	return atoi(param);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_cache_stress                                    *
+ *                                                                            *
+ * Purpose: contention test of the shared cache                               *
+ *                                                                            *
+ * Parameters: request - cloud.cache.stress[readers, writers, seconds,        *
+ *                       instances, <view>], view is shared (default) or      *
+ *                       local to benchmark the local views of the readers    *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - JSON report is returned                     *
+ *               SYSINFO_RET_FAIL - test is disabled or cannot be started     *
+ *                                                                            *
+ * Comment: forks reader processes calling the getters, cloud.instance.list   *
+ *          and a consistency check, and writer processes refreshing a mock   *
+ *          service as cloud.monitor does. Requires EnableStressTest=1.       *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_cache_stress(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int				i, readers, writers, seconds, num, fds[2], processes = 0, reports = 0, check_errors;
+	pid_t				pid;
+	double				deadline, elapsed;
+	zbx_uint64_t			used_size;
+	char				round[64], torn_reads[64] = "";
+	const char			*view;
+	sigset_t			orig_mask;
+	struct deltacloud_instance	*instances;
+	zbx_deltacloud_service_t	*service;
+	zbx_cloud_stress_stats_t	stats, total;
+
+	if (1 != CONFIG_ENABLE_STRESS_TEST)
+	{
+		SET_MSG_RESULT(result, strdup("Stress test is disabled, set EnableStressTest=1 in " MODULE_CONFIG_FILE));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (request->nparam > 5)
 	{
 		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.monitor[url, key, secret, driver, provider]"));
+		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.cache.stress[readers, writers, seconds, instances, <view>]"));
 		return SYSINFO_RET_FAIL;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
-	zbx_vector_ptr_clean(&service->instances, (zbx_mem_free_func_t)cloud_instance_shared_free);
-	deltacloud_initialize(&api, url, key, secret, driver, provider);
+	if (5 > request->nparam || NULL == (view = get_rparam(request, 4)) || '\0' == *view)
+		view = "shared";
+
+	if (0 != strcmp(view, "shared") && 0 != strcmp(view, "local"))
+	{
+		SET_MSG_RESULT(result, strdup("Invalid view, must be shared or local"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	readers = cloud_int_param(request, 0, 4);
+	writers = cloud_int_param(request, 1, 1);
+	seconds = cloud_int_param(request, 2, 1);
+	num = cloud_int_param(request, 3, 100);
+
+	if (0 > readers || 64 < readers || 0 > writers || 16 < writers || 1 > seconds || 60 < seconds || 1 > num)
+	{
+		SET_MSG_RESULT(result, strdup("Invalid parameters, up to 64 readers, 16 writers and 60 seconds are allowed"));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (-1 == pipe(fds))
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot create pipe: %s", zbx_strerror(errno)));
+		return SYSINFO_RET_FAIL;
+	}
+
+	zbx_snprintf(round, sizeof(round), "%d.init", (int)getpid());
+	instances = cloud_mock_instances(num, round);
+
+	cloud_lock();
+	service = zbx_deltacloud_get_service(STRESS_URL, "", "", STRESS_DRIVER, "");
+	used_size = cloud_mem->used_size;
+	cloud_service_update_instances(service, instances);
+	cloud_unlock();
+
+	cloud_mock_instances_free(instances);
+
+	deadline = zbx_time() + seconds;
+
+	cloud_sigchld_block(&orig_mask);
+
+	for (i = 0; i < readers + writers; i++)
+	{
+		if (-1 == (pid = fork()))
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "cloud.cache.stress: cannot fork: %s", zbx_strerror(errno));
+			break;
+		}
+
+		if (0 == pid)
+		{
+			cloud_sigchld_child(&orig_mask);
+			close(fds[0]);
+			memset(&stats, 0, sizeof(stats));
+			srand(getpid());
+
+			if (i < readers)
+			{
+				CONFIG_LOCAL_VIEW = (0 == strcmp(view, "local") ? 1 : 0);
+				cloud_stress_reader(service, deadline, &stats);
+			}
+			else
+				cloud_stress_writer(service, num, deadline, &stats);
+
+			if (sizeof(stats) != write(fds[1], &stats, sizeof(stats)))
+				_exit(EXIT_FAILURE);
+
+			_exit(EXIT_SUCCESS);
+		}
+
+		processes++;
+	}
+
+	close(fds[1]);
+
+	memset(&total, 0, sizeof(total));
+
+	while (sizeof(stats) == read(fds[0], &stats, sizeof(stats)))
+	{
+		reports++;
+		total.reads += stats.reads;
+		total.refreshes += stats.refreshes;
+		total.torn_reads += stats.torn_reads;
+		total.check_errors += stats.check_errors;
+		total.refresh_time += stats.refresh_time;
+		total.getter_reads += stats.getter_reads;
+		total.getter_time += stats.getter_time;
+
+		if (stats.refresh_time_max > total.refresh_time_max)
+			total.refresh_time_max = stats.refresh_time_max;
+	}
+
+	close(fds[0]);
+
+	for (i = 0; i < processes; i++)
+		wait(NULL);
+
+	cloud_sigchld_unblock(&orig_mask);
+
+	elapsed = zbx_time() - deadline + seconds;
+
+	/* processes which did not report have crashed, most likely on a corrupted cache */
+	reports = processes - reports;
+
+	/* empty the stress service, the allocator must return to the initial usage */
+	cloud_lock();
+
+	/* the freed memory is subtracted from the service, the consistency check verifies it */
+	service->mem_used -= cloud_mem->used_size;
+
+	cloud_instances_shared_reset(service, 0, 0);
+	cloud_instances_index(service, __cloud_mem_malloc_func, __cloud_mem_realloc_func, __cloud_mem_free_func);
+
+	service->mem_used += cloud_mem->used_size;
+
+	used_size = cloud_mem->used_size > used_size ? cloud_mem->used_size - used_size : 0;
+	check_errors = cloud_cache_check();
+
+	for (i = 0; i < deltacloud->services.values_num; i++)
+	{
+		if (service == deltacloud->services.values[i])
+		{
+			zbx_vector_ptr_remove(&deltacloud->services, i);
+			cloud_service_shared_free(service);
+			break;
+		}
+	}
+
+	cloud_unlock();
+
+	/* shared reads are made under the lock and cannot be torn */
+	if (0 == strcmp(view, "local"))
+		zbx_snprintf(torn_reads, sizeof(torn_reads), "\"torn_reads\":" ZBX_FS_UI64 ",", total.torn_reads);
+
+	SET_TEXT_RESULT(result, zbx_dsprintf(NULL, "{\"view\":\"%s\",\"readers\":%d,\"writers\":%d,\"seconds\":%.3f,\"instances\":%d,"
+			"\"reads\":" ZBX_FS_UI64 ",\"reads_per_sec\":%.1f,\"getter_latency_avg_us\":%.3f,\"refreshes\":" ZBX_FS_UI64 ","
+			"\"refresh_latency_avg_ms\":%.3f,\"refresh_latency_max_ms\":%.3f,%s"
+			"\"check_errors\":" ZBX_FS_UI64 ",\"crashed\":%d,\"leaked_bytes\":" ZBX_FS_UI64 "}",
+			view, readers, writers, elapsed, num, total.reads, total.reads / elapsed,
+			0 != total.getter_reads ? total.getter_time * 1000000 / total.getter_reads : 0.0, total.refreshes,
+			0 != total.refreshes ? total.refresh_time * 1000 / total.refreshes : 0.0,
+			total.refresh_time_max * 1000, torn_reads, total.check_errors + check_errors, reports, used_size));
+
+	return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_load_config                                                *
+ *                                                                            *
+ * Purpose: read optional module configuration file                           *
+ *                                                                            *
+ * Return value: SUCCEED - configuration is valid                             *
+ *               FAIL - otherwise                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_load_config(void)
+{
+	struct cfg_line	cfg[] =
+	{
+		/* PARAMETER,		VAR,				TYPE,		MANDATORY,	MIN,	MAX */
+		{"CacheMode",		&CONFIG_CACHE_MODE,		TYPE_STRING,	PARM_OPT,	0,	0},
+		{"CacheSocket",		&CONFIG_CACHE_SOCKET,		TYPE_STRING,	PARM_OPT,	0,	0},
+		{"RefreshInterval",	&CONFIG_REFRESH_INTERVAL,	TYPE_INT,	PARM_OPT,	0,	SEC_PER_DAY},
+		{"EnableStressTest",	&CONFIG_ENABLE_STRESS_TEST,	TYPE_INT,	PARM_OPT,	0,	1},
+		{"CompactionThreshold",	&CONFIG_COMPACTION_THRESHOLD,	TYPE_INT,	PARM_OPT,	0,	100},
+		{"Service",		&CONFIG_SERVICES,		TYPE_MULTISTRING,	PARM_OPT,	0,	0},
+		{"RefreshCollections",	&CONFIG_REFRESH_COLLECTIONS,	TYPE_INT,	PARM_OPT,	0,	1},
+		{"BreakerThreshold",	&CONFIG_BREAKER_THRESHOLD,	TYPE_INT,	PARM_OPT,	0,	1000},
+		{"BreakerProbeInterval",	&CONFIG_BREAKER_PROBE_INTERVAL,	TYPE_INT,	PARM_OPT,	1,	SEC_PER_DAY},
+		{"LocalView",		&CONFIG_LOCAL_VIEW,		TYPE_INT,	PARM_OPT,	0,	1},
+		{"ColdFieldsTimeout",	&CONFIG_COLD_FIELDS_TIMEOUT,	TYPE_INT,	PARM_OPT,	0,	SEC_PER_WEEK},
+		{"ServiceMemoryLimit",	&CONFIG_SERVICE_MEMORY_LIMIT,	TYPE_UINT64,	PARM_OPT,	0,	MEM_SIZE},
+		{"StateChangesWindow",	&CONFIG_STATE_CHANGES_WINDOW,	TYPE_INT,	PARM_OPT,	1,	SEC_PER_WEEK},
+		{"FleetSamples",	&CONFIG_FLEET_SAMPLES,		TYPE_INT,	PARM_OPT,	0,	65536},
+		{"ExportDir",		&CONFIG_EXPORT_DIR,		TYPE_STRING,	PARM_OPT,	0,	0},
+		{NULL}
+	};
+
+	parse_cfg_file(MODULE_CONFIG_FILE, cfg, ZBX_CFG_FILE_OPTIONAL, ZBX_CFG_STRICT);
+
+	if (NULL == CONFIG_CACHE_SOCKET)
+		CONFIG_CACHE_SOCKET = zbx_strdup(CONFIG_CACHE_SOCKET, CACHE_SOCKET);
+
+	if (NULL == CONFIG_CACHE_MODE || 0 == strcmp(CONFIG_CACHE_MODE, "local"))
+		cache_mode = CLOUD_CACHE_MODE_LOCAL;
+	else if (0 == strcmp(CONFIG_CACHE_MODE, "server"))
+		cache_mode = CLOUD_CACHE_MODE_SERVER;
+	else if (0 == strcmp(CONFIG_CACHE_MODE, "client"))
+		cache_mode = CLOUD_CACHE_MODE_CLIENT;
+	else
+	{
+		zabbix_log(LOG_LEVEL_CRIT, "invalid CacheMode \"%s\" in \"%s\": must be local, server or client",
+				CONFIG_CACHE_MODE, MODULE_CONFIG_FILE);
+		return FAIL;
+	}
+
+	if (sizeof(((struct sockaddr_un *)NULL)->sun_path) <= strlen(CONFIG_CACHE_SOCKET))
+	{
+		zabbix_log(LOG_LEVEL_CRIT, "CacheSocket \"%s\" is too long", CONFIG_CACHE_SOCKET);
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_fork_detached                                              *
+ *                                                                            *
+ * Purpose: start a process which is not a child of the calling one           *
+ *                                                                            *
+ * Return value: 0 in the started process, its pid in the caller and -1 on    *
+ *               failure                                                      *
+ *                                                                            *
+ * Comment: agent parent process exits when any of its children dies, so     *
+ *          module processes are double forked and the SIGCHLD of the         *
+ *          intermediate child is consumed here                               *
+ *                                                                            *
+ ******************************************************************************/
+static pid_t	cloud_fork_detached(void)
+{
+	pid_t		pid = -1, child;
+	int		fds[2];
+	sigset_t	orig_mask;
+
+	if (-1 == pipe(fds))
+		return -1;
 
-	deltacloud_get_instances(&api, &instance);
+	cloud_sigchld_block(&orig_mask);
 
-	if(instance==NULL){
-		SET_UI64_RESULT(result, 0);
-		return SYSINFO_RET_OK;
-	}
-	
-	while(1){
-		deltacloud_instance = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_instance_t));
-		zabbix_log(LOG_LEVEL_ERR, "-------used_size: %d---\n", cloud_mem->used_size);
-		deltacloud_instance->href = cloud_shared_strdup(instance->href);
-		deltacloud_instance->id = cloud_shared_strdup(instance->id);
-		deltacloud_instance->name = cloud_shared_strdup(instance->name);
-		deltacloud_instance->owner_id = cloud_shared_strdup(instance->owner_id);
-		deltacloud_instance->image_id = cloud_shared_strdup(instance->image_id);
-		deltacloud_instance->image_href = cloud_shared_strdup(instance->image_href);
-		deltacloud_instance->realm_id = cloud_shared_strdup(instance->realm_id);
-		deltacloud_instance->realm_href = cloud_shared_strdup(instance->realm_href);
-		deltacloud_instance->state = cloud_shared_strdup(instance->state);
-		deltacloud_instance->launch_time = cloud_shared_strdup(instance->launch_time);
+	if (-1 == (child = fork()))
+		goto out;
 
-		/* Add IP address information */
-		CLOUD_VECTOR_CREATE(&deltacloud_instance->public_addresses, ptr);
-		CLOUD_VECTOR_CREATE(&deltacloud_instance->private_addresses, ptr);
-		public_address = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_address_t));
-		private_address = __cloud_mem_malloc_func(NULL, sizeof(zbx_deltacloud_address_t));
+	if (0 == child)
+	{
+		if (0 == (pid = fork()))
+		{
+			close(fds[0]);
+			close(fds[1]);
 
-		if(instance->public_addresses)
-			public_address->address = cloud_shared_strdup(instance->public_addresses->address);
-		if(instance->private_addresses)
-			private_address->address = cloud_shared_strdup(instance->private_addresses->address);
+			/* the agent handler of the parent process would exit on SIGCHLD of own children */
+			cloud_sigchld_child(&orig_mask);
+			return 0;
+		}
 
-		
-		zbx_vector_ptr_append(&deltacloud_instance->public_addresses, public_address);
-		zbx_vector_ptr_append(&deltacloud_instance->private_addresses, private_address);
+		if (sizeof(pid) != write(fds[1], &pid, sizeof(pid)))
+			_exit(EXIT_FAILURE);
 
-		deltacloud_instance->hwp = cloud_hardware_profile_shared_dup(&instance->hwp);
-		zbx_vector_ptr_append(&service->instances, deltacloud_instance);
-		zabbix_log(LOG_LEVEL_ERR, "-------used_size: %d---\n", cloud_mem->used_size);
-		instance = instance->next;
-		if(instance == NULL){
-			break;
-		}
+		_exit(EXIT_SUCCESS);
 	}
 
-	SET_UI64_RESULT(result, 1);
-	return SYSINFO_RET_OK;
+	if (sizeof(pid) != read(fds[0], &pid, sizeof(pid)))
+		pid = -1;
+
+	waitpid(child, NULL, 0);
+out:
+	cloud_sigchld_unblock(&orig_mask);
+	close(fds[0]);
+	close(fds[1]);
+
+	return pid;
 }
 
-int	zbx_module_cloud_instance_status(AGENT_REQUEST *request, AGENT_RESULT *result)
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_socket_timeout                                             *
+ *                                                                            *
+ * Purpose: limit the time a read or write on the cache socket may block      *
+ *                                                                            *
+ * Comment: only the socket I/O is limited, a timed out call fails with       *
+ *          EAGAIN and the process is never stopped while it holds the cache  *
+ *          lock                                                              *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_socket_timeout(int fd, int timeout)
 {
+	struct timeval	tv;
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
 
-	if (request->nparam != 6)
-	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.status[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
-	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_socket_peer_check                                          *
+ *                                                                            *
+ * Purpose: check that the other end of the cache socket runs as the same     *
+ *          user as the agent                                                 *
+ *                                                                            *
+ * Return value: SUCCEED - the peer is the agent user or root                 *
+ *               FAIL - otherwise, error is set                               *
+ *                                                                            *
+ * Comment: item requests carry the key and secret of the services, neither   *
+ *          end may talk to a process of another user                         *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_socket_peer_check(int fd, char **error)
+{
+#ifdef SO_PEERCRED
+	struct ucred	cred;
+	socklen_t	len = sizeof(cred);
 
-	if (service == NULL)
+	if (-1 == getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		*error = zbx_dsprintf(*error, "cannot get peer credentials: %s", zbx_strerror(errno));
+		return FAIL;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	if (geteuid() != cred.uid && 0 != cred.uid)
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->state));
-			return SYSINFO_RET_OK;
-		}
+		*error = zbx_dsprintf(*error, "peer process #%d runs as user %d", (int)cred.pid, (int)cred.uid);
+		return FAIL;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+#else
+	ZBX_UNUSED(fd);
+	ZBX_UNUSED(error);
+#endif
+	return SUCCEED;
 }
 
-int	zbx_module_cloud_instance_image_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+static int	cloud_socket_write(int fd, const char *buf, size_t len)
 {
+	ssize_t	n;
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
-
-	if (request->nparam != 6)
+	while (0 < len)
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.image_id[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
-	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
+		if (-1 == (n = write(fd, buf, len)))
+		{
+			if (EINTR == errno)
+				continue;
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+			return FAIL;
+		}
 
-	if (service == NULL)
-	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		buf += n;
+		len -= n;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	return SUCCEED;
+}
+
+static int	cloud_socket_read(int fd, char *buf, size_t len)
+{
+	ssize_t	n;
+
+	while (0 < len)
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
+		if (0 >= (n = read(fd, buf, len)))
 		{
-			SET_STR_RESULT(result, strdup(instance->image_id));
-			return SYSINFO_RET_OK;
+			if (-1 == n && EINTR == errno)
+				continue;
+
+			return FAIL;
 		}
+
+		buf += n;
+		len -= n;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+
+	return SUCCEED;
 }
-int	zbx_module_cloud_instance_owner_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_message_send                                               *
+ *                                                                            *
+ * Purpose: send cache daemon message                                         *
+ *                                                                            *
+ * Comment: message is the payload length in host byte order followed by the  *
+ *          payload, both ends are on the same host                           *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_message_send(int fd, const char *data, unsigned int len)
 {
+	if (SUCCEED != cloud_socket_write(fd, (const char *)&len, sizeof(len)))
+		return FAIL;
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	return cloud_socket_write(fd, data, len);
+}
 
-	if (request->nparam != 6)
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_message_recv                                               *
+ *                                                                            *
+ * Purpose: receive cache daemon message                                      *
+ *                                                                            *
+ * Return value: NUL terminated payload which must be freed by the caller or  *
+ *               NULL on failure                                              *
+ *                                                                            *
+ ******************************************************************************/
+static char	*cloud_message_recv(int fd, unsigned int *len)
+{
+	char	*data;
+
+	if (SUCCEED != cloud_socket_read(fd, (char *)len, sizeof(*len)) || CACHE_MAX_MESSAGE < *len)
+		return NULL;
+
+	data = zbx_malloc(NULL, *len + 1);
+
+	if (SUCCEED != cloud_socket_read(fd, data, *len))
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.owner_id[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		zbx_free(data);
+		return NULL;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	data[*len] = '\0';
+
+	return data;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_cache_serve                                                *
+ *                                                                            *
+ * Purpose: process one item request of a cache client                        *
+ *                                                                            *
+ * Comment: request payload is the item key and its parameters, each NUL      *
+ *          terminated. Response payload is the result type ('u' - unsigned,  *
+ *          'd' - float, 's' - string, 't' - text, 'm' - error message)       *
+ *          followed by the value as NUL terminated text.                     *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_cache_serve(int fd)
+{
+	char		*data, *ptr, *response = NULL, type = 'm';
+	const char	*value = "Unsupported item key.";
+	char		buffer[MAX_STRING_LEN];
+	unsigned int	len;
+	size_t		response_alloc = 0, response_offset = 0;
+	int		i, ret = SYSINFO_RET_FAIL;
+	AGENT_REQUEST	request;
+	AGENT_RESULT	result;
+
+	if (NULL == (data = cloud_message_recv(fd, &len)))
+		return;
+
+	init_request(&request);
+	init_result(&result);
 
-	if (service == NULL)
+	request.key = zbx_strdup(NULL, data);
+
+	for (ptr = data + strlen(data) + 1; ptr < data + len; ptr += strlen(ptr) + 1)
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		request.params = zbx_realloc(request.params, sizeof(char *) * (request.nparam + 1));
+		request.params[request.nparam++] = zbx_strdup(NULL, ptr);
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	for (i = 0; NULL != keys[i].key; i++)
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
+		if (0 == strcmp(keys[i].key, request.key))
 		{
-			SET_STR_RESULT(result, strdup(instance->owner_id));
-			return SYSINFO_RET_OK;
+			ret = keys[i].function(&request, &result);
+			break;
 		}
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
-}
-int	zbx_module_cloud_instance_image_href(AGENT_REQUEST *request, AGENT_RESULT *result)
-{
-
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
 
-	if (request->nparam != 6)
+	if (NULL == keys[i].key)
+		;
+	else if (SYSINFO_RET_OK != ret)
+		value = ISSET_MSG(&result) ? result.msg : "";
+	else if (ISSET_UI64(&result))
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.image_href[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		type = 'u';
+		zbx_snprintf(buffer, sizeof(buffer), ZBX_FS_UI64, result.ui64);
+		value = buffer;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
-
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
-
-	if (service == NULL)
+	else if (ISSET_DBL(&result))
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		type = 'd';
+		zbx_snprintf(buffer, sizeof(buffer), ZBX_FS_DBL, result.dbl);
+		value = buffer;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+	else if (ISSET_STR(&result))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->image_href));
-			return SYSINFO_RET_OK;
-		}
+		type = 's';
+		value = result.str;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+	else if (ISSET_TEXT(&result))
+	{
+		type = 't';
+		value = result.text;
+	}
+
+	zbx_chrcpy_alloc(&response, &response_alloc, &response_offset, type);
+	zbx_strcpy_alloc(&response, &response_alloc, &response_offset, value);
+
+	cloud_message_send(fd, response, response_offset + 1);
+
+	zbx_free(response);
+	free_result(&result);
+	free_request(&request);
+	zbx_free(data);
 }
-int	zbx_module_cloud_instance_realm_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_cache_listener                                             *
+ *                                                                            *
+ * Purpose: accept item requests of other agents on the cache socket          *
+ *                                                                            *
+ * Comment: each connection is served by its own process, so a slow           *
+ *          cloud.monitor does not hold up the getters of other agents        *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_cache_listener(int listen_fd)
 {
+	int	fd;
+	char	*error = NULL;
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
 
-	if (request->nparam != 6)
+	zabbix_log(LOG_LEVEL_INFORMATION, "cloud cache daemon #%d started, listening on \"%s\"", (int)getpid(),
+			CONFIG_CACHE_SOCKET);
+
+	for (;;)
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.realm_id[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		if (-1 == (fd = accept(listen_fd, NULL, NULL)))
+		{
+			if (EINTR != errno)
+			{
+				zabbix_log(LOG_LEVEL_WARNING, "cloud cache daemon: cannot accept connection: %s",
+						zbx_strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		if (SUCCEED != cloud_socket_peer_check(fd, &error))
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "cloud cache daemon: connection rejected: %s", error);
+			zbx_free(error);
+			close(fd);
+			continue;
+		}
+
+		switch (fork())
+		{
+			case -1:
+				zabbix_log(LOG_LEVEL_WARNING, "cloud cache daemon: cannot fork: %s", zbx_strerror(errno));
+				break;
+			case 0:
+				close(listen_fd);
+				cloud_socket_timeout(fd, CACHE_TIMEOUT);
+				cloud_cache_serve(fd);
+				_exit(EXIT_SUCCESS);
+		}
+
+		close(fd);
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
+}
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+static pid_t	cloud_listener_pid = -1;
 
-	if (service == NULL)
-	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_socket_dir_check                                           *
+ *                                                                            *
+ * Purpose: check that the directory of the cache socket belongs to the      *
+ *          agent user                                                        *
+ *                                                                            *
+ * Comment: otherwise another user could replace the socket and receive the   *
+ *          item requests of the clients                                      *
+ *                                                                            *
+ ******************************************************************************/
+static int	cloud_socket_dir_check(const char *path)
+{
+	char		*dir, *ptr;
+	struct stat	st;
+	int		ret = FAIL;
+
+	dir = zbx_strdup(NULL, path);
+
+	if (NULL == (ptr = strrchr(dir, '/')))
+		dir = zbx_strdup(dir, ".");
+	else if (ptr == dir)
+		ptr[1] = '\0';
+	else
+		*ptr = '\0';
+
+	if (0 != stat(dir, &st))
+	{
+		zabbix_log(LOG_LEVEL_CRIT, "cannot access cloud cache socket directory \"%s\": %s", dir,
+				zbx_strerror(errno));
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+	else if (!S_ISDIR(st.st_mode) || geteuid() != st.st_uid || 0 != (st.st_mode & (S_IWGRP | S_IWOTH)))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->realm_id));
-			return SYSINFO_RET_OK;
-		}
+		zabbix_log(LOG_LEVEL_CRIT, "cloud cache socket directory \"%s\" must be a directory owned by the agent"
+				" user and not writable by group or others", dir);
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+	else
+		ret = SUCCEED;
+
+	zbx_free(dir);
+
+	return ret;
 }
-int	zbx_module_cloud_instance_realm_href(AGENT_REQUEST *request, AGENT_RESULT *result)
+
+static int	cloud_cache_listener_start(void)
 {
+	int			fd, err;
+	mode_t			mask;
+	struct sockaddr_un	addr;
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	if (SUCCEED != cloud_socket_dir_check(CONFIG_CACHE_SOCKET))
+		return FAIL;
 
-	if (request->nparam != 6)
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	zbx_strlcpy(addr.sun_path, CONFIG_CACHE_SOCKET, sizeof(addr.sun_path));
+
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0)))
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.realm_href[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		zabbix_log(LOG_LEVEL_CRIT, "cannot create cloud cache socket: %s", zbx_strerror(errno));
+		return FAIL;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	unlink(CONFIG_CACHE_SOCKET);
 
-	if (service == NULL)
+	/* the socket is created with 0660 permissions, there is no window where others may connect */
+	mask = umask(0117);
+	err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if (-1 == err || -1 == chmod(CONFIG_CACHE_SOCKET, 0660) || -1 == listen(fd, SOMAXCONN))
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		zabbix_log(LOG_LEVEL_CRIT, "cannot listen on cloud cache socket \"%s\": %s", CONFIG_CACHE_SOCKET,
+				zbx_strerror(errno));
+		close(fd);
+		return FAIL;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	if (0 == (cloud_listener_pid = cloud_fork_detached()))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->realm_href));
-			return SYSINFO_RET_OK;
-		}
+		cloud_cache_listener(fd);
+		_exit(EXIT_SUCCESS);
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
-}
-int	zbx_module_cloud_instance_launch_time(AGENT_REQUEST *request, AGENT_RESULT *result)
-{
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	close(fd);
 
-	if (request->nparam != 6)
+	if (-1 == cloud_listener_pid)
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.launch_time[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		zabbix_log(LOG_LEVEL_CRIT, "cannot start cloud cache daemon: %s", zbx_strerror(errno));
+		unlink(CONFIG_CACHE_SOCKET);
+		return FAIL;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_cloud_proxy                                           *
+ *                                                                            *
+ * Purpose: forward item request to the cache daemon of the host              *
+ *                                                                            *
+ * Comment: in client mode every module item is processed here, the agent     *
+ *          keeps no cache of its own                                         *
+ *                                                                            *
+ ******************************************************************************/
+int	zbx_module_cloud_proxy(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	int			i, fd = -1, ret = SYSINFO_RET_FAIL;
+	char			*data = NULL, *response = NULL, *error = NULL;
+	size_t			data_alloc = 0, data_offset = 0;
+	unsigned int		len;
+	struct sockaddr_un	addr;
 
-	if (service == NULL)
+	zbx_strcpy_alloc(&data, &data_alloc, &data_offset, request->key);
+	zbx_chrcpy_alloc(&data, &data_alloc, &data_offset, '\0');
+
+	for (i = 0; i < request->nparam; i++)
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		zbx_strcpy_alloc(&data, &data_alloc, &data_offset, request->params[i]);
+		zbx_chrcpy_alloc(&data, &data_alloc, &data_offset, '\0');
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	zbx_strlcpy(addr.sun_path, CONFIG_CACHE_SOCKET, sizeof(addr.sun_path));
+
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0)))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->launch_time));
-			return SYSINFO_RET_OK;
-		}
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot create socket: %s", zbx_strerror(errno)));
+		goto out;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
-}
-int	zbx_module_cloud_instance_hwp_href(AGENT_REQUEST *request, AGENT_RESULT *result)
-{
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	cloud_socket_timeout(fd, 0 != item_timeout ? item_timeout : CACHE_TIMEOUT);
 
-	if (request->nparam != 6)
+	if (-1 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.hwp.href[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot connect to cloud cache daemon \"%s\": %s",
+				CONFIG_CACHE_SOCKET, zbx_strerror(errno)));
+		goto out;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	if (SUCCEED != cloud_socket_peer_check(fd, &error))
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cloud cache daemon \"%s\" is not trusted: %s",
+				CONFIG_CACHE_SOCKET, error));
+		zbx_free(error);
+		goto out;
+	}
 
-	if (service == NULL)
+	if (SUCCEED != cloud_message_send(fd, data, data_offset) || NULL == (response = cloud_message_recv(fd, &len)) ||
+			0 == len)
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		SET_MSG_RESULT(result, strdup("Cannot receive response from cloud cache daemon"));
+		goto out;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	ret = SYSINFO_RET_OK;
+
+	switch (response[0])
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->hwp->href));
-			return SYSINFO_RET_OK;
-		}
+		case 'u':
+			SET_UI64_RESULT(result, strtoull(response + 1, NULL, 10));
+			break;
+		case 'd':
+			SET_DBL_RESULT(result, atof(response + 1));
+			break;
+		case 's':
+			SET_STR_RESULT(result, strdup(response + 1));
+			break;
+		case 't':
+			SET_TEXT_RESULT(result, strdup(response + 1));
+			break;
+		default:
+			SET_MSG_RESULT(result, strdup(response + 1));
+			ret = SYSINFO_RET_FAIL;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+out:
+	if (-1 != fd)
+		close(fd);
+
+	zbx_free(response);
+	zbx_free(data);
+
+	return ret;
 }
-int	zbx_module_cloud_instance_hwp_id(AGENT_REQUEST *request, AGENT_RESULT *result)
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_warmup                                             *
+ *                                                                            *
+ * Purpose: register a service listed in the module configuration and start  *
+ *          a process fetching its instances                                  *
+ *                                                                            *
+ * Parameters: line - Service parameter value:                                *
+ *                    <url>,<driver>,<provider>,<credentials file>            *
+ *                                                                            *
+ * Comment: the credentials file holds Key and Secret parameters, they must   *
+ *          be the same as the key and secret parameters of the items, and    *
+ *          optional MemoryLimit of the service                               *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_service_warmup(const char *line)
 {
+	char				*buffer, *fields[4], *ptr, *key = NULL, *secret = NULL;
+	size_t				i;
+	pid_t				pid;
+	zbx_uint64_t			memory_limit = 0;
+	zbx_deltacloud_service_t	*service;
+	struct cfg_line			cfg[] =
+	{
+		/* PARAMETER,	VAR,		TYPE,		MANDATORY,	MIN,	MAX */
+		{"Key",		&key,		TYPE_STRING,	PARM_OPT,	0,	0},
+		{"Secret",	&secret,	TYPE_STRING,	PARM_OPT,	0,	0},
+		{"MemoryLimit",	&memory_limit,	TYPE_UINT64,	PARM_OPT,	0,	MEM_SIZE},
+		{NULL}
+	};
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	buffer = zbx_strdup(NULL, line);
 
-	if (request->nparam != 6)
+	for (ptr = buffer, i = 0; i < ARRSIZE(fields); i++)
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.hwp.id[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
-	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
+		fields[i] = ptr;
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+		if (ARRSIZE(fields) - 1 == i)
+			break;
 
-	if (service == NULL)
-	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		if (NULL == (ptr = strchr(ptr, ',')))
+			break;
+
+		*ptr++ = '\0';
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	if (ARRSIZE(fields) != i + 1 || NULL != strchr(fields[ARRSIZE(fields) - 1], ','))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
-		{
-			SET_STR_RESULT(result, strdup(instance->hwp->id));
-			return SYSINFO_RET_OK;
-		}
+		zabbix_log(LOG_LEVEL_WARNING, "invalid Service \"%s\" in \"%s\": must be"
+				" <url>,<driver>,<provider>,<credentials file>", line, MODULE_CONFIG_FILE);
+		goto out;
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
-}
-int	zbx_module_cloud_instance_hwp_name(AGENT_REQUEST *request, AGENT_RESULT *result)
-{
 
-	int	i;
-	char	*url;
-	char	*key;
-	char	*secret;
-	char	*driver;
-	char	*provider;
-	char	*instance_id;
-	
-	zbx_deltacloud_service_t	*service = NULL;
-	zbx_deltacloud_instance_t	*deltacloud_instance = NULL;
+	for (i = 0; i < ARRSIZE(fields); i++)
+		zbx_lrtrim(fields[i], " \t");
 
-	if (request->nparam != 6)
+	if (0 != access(fields[3], R_OK))
 	{
-		/* set optional error message */
-		SET_MSG_RESULT(result, strdup("Invalid number of parameters e.g.) cloud.instane.hwp.name[url, key, secret, driver, provider, instance_id]"));
-		return SYSINFO_RET_FAIL;
+		zabbix_log(LOG_LEVEL_WARNING, "cannot read credentials of service \"%s\" from \"%s\": %s", fields[0],
+				fields[3], zbx_strerror(errno));
+		goto out;
 	}
-	url = get_rparam(request, 0);
-	key = get_rparam(request, 1);
-	secret = get_rparam(request, 2);
-	driver = get_rparam(request, 3);
-	provider = get_rparam(request, 4);
-	instance_id = get_rparam(request, 5);
 
-	service = zbx_deltacloud_get_service(url, key, secret, driver, provider);
+	parse_cfg_file(fields[3], cfg, ZBX_CFG_FILE_REQUIRED, ZBX_CFG_STRICT);
 
-	if (service == NULL)
+	if (NULL == key || NULL == secret)
 	{
-		SET_MSG_RESULT(result, strdup("No Data"));
-		return SYSINFO_RET_FAIL;
+		zabbix_log(LOG_LEVEL_WARNING, "credentials file \"%s\" of service \"%s\" must contain Key and Secret",
+				fields[3], fields[0]);
+		goto out;
 	}
-	
-	for (i = 0; service->instances.values_num; i++)
+
+	cloud_lock();
+	service = zbx_deltacloud_get_service(fields[0], key, secret, fields[1], fields[2]);
+	service->mem_limit = memory_limit;
+	cloud_unlock();
+
+	if (0 == (pid = cloud_fork_detached()))
 	{
-		zbx_deltacloud_instance_t *instance = service->instances.values[i];
-		if (0 == strcmp(instance->id, instance_id))
+		/* only stored instances may spare the first cloud.monitor its fetch */
+		if (SUCCEED == cloud_service_refresh(service, fields[0], key, secret, fields[1], fields[2]))
 		{
-			SET_STR_RESULT(result, strdup(instance->hwp->name));
-			return SYSINFO_RET_OK;
+			cloud_lock();
+			service->lastcheck = time(NULL);
+			cloud_unlock();
 		}
+		else
+			zabbix_log(LOG_LEVEL_WARNING, "cannot fetch instances of service \"%s\"", fields[0]);
+
+		_exit(EXIT_SUCCESS);
 	}
-	SET_MSG_RESULT(result, strdup("Not match data"));
-	return SYSINFO_RET_FAIL;
+
+	if (-1 == pid)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "cannot start warm-up of service \"%s\": %s", fields[0],
+				zbx_strerror(errno));
+	}
+	else
+		zabbix_log(LOG_LEVEL_INFORMATION, "started warm-up of service \"%s\"", fields[0]);
+out:
+	zbx_free(key);
+	zbx_free(secret);
+	zbx_free(buffer);
 }
+
 /******************************************************************************
  *                                                                            *
  * Function: zbx_module_init                                                  *
@@ -897,9 +5896,36 @@ int	zbx_module_cloud_instance_hwp_name(AGENT_REQUEST *request, AGENT_RESULT *res
  ******************************************************************************/
 int	zbx_module_init()
 {
+	int	i;
+
 	/* initialization for dummy.random */
 	srand(time(NULL));
 
+	if (SUCCEED != cloud_load_config())
+		return ZBX_MODULE_FAIL;
+
+	if (CLOUD_CACHE_MODE_CLIENT == cache_mode)
+	{
+		for (i = 0; NULL != keys[i].key; i++)
+			;
+
+		client_keys = zbx_malloc(NULL, sizeof(ZBX_METRIC) * (i + 1));
+		memcpy(client_keys, keys, sizeof(ZBX_METRIC) * (i + 1));
+
+		for (i = 0; NULL != client_keys[i].key; i++)
+			client_keys[i].function = zbx_module_cloud_proxy;
+
+		zabbix_log(LOG_LEVEL_INFORMATION, "cloud items are forwarded to cache daemon at \"%s\"", CONFIG_CACHE_SOCKET);
+
+		return ZBX_MODULE_OK;
+	}
+
+	if (-1 == (cloud_semid = semget(IPC_PRIVATE, 1, 0600)) || -1 == semctl(cloud_semid, 0, SETVAL, 1))
+	{
+		zabbix_log(LOG_LEVEL_CRIT, "cannot create cloud cache lock: %s", zbx_strerror(errno));
+		return ZBX_MODULE_FAIL;
+	}
+
 	key_t shm_key;
 	shm_key = zbx_ftok(CONFIG_FILE, ZBX_IPC_CLOUD_ID);
 	zbx_mem_create(&cloud_mem, shm_key, ZBX_NO_MUTEX, MEM_SIZE, "cloud cache size", "CloudCacheSize", 0);
@@ -914,76 +5940,134 @@ int	zbx_module_init()
 
 	CLOUD_VECTOR_CREATE(&deltacloud->services, ptr);
 
+	if (CLOUD_CACHE_MODE_SERVER == cache_mode && SUCCEED != cloud_cache_listener_start())
+		return ZBX_MODULE_FAIL;
+
+	/* services are fetched in parallel, each by its own process */
+	for (i = 0; NULL != CONFIG_SERVICES && NULL != CONFIG_SERVICES[i]; i++)
+		cloud_service_warmup(CONFIG_SERVICES[i]);
+
 	return ZBX_MODULE_OK;
 }
 
-static void	cloud_address_shared_free(zbx_deltacloud_address_t *address)
+static void	cloud_address_free(zbx_deltacloud_address_t *address, zbx_mem_free_func_t free_func)
 {
 	if (NULL != address->address)
-		__cloud_mem_free_func(address->address);
-	__cloud_mem_free_func(address);
-	zabbix_log(LOG_LEVEL_ERR, "--free instance-----used_size: %d---\n", cloud_mem->used_size);
+		free_func(address->address);
+	free_func(address);
 }
 
-static void	cloud_hardware_profile_shared_free(zbx_deltacloud_hardware_profile_t *hwp)
+static void	cloud_addresses_clear(zbx_vector_ptr_t *addresses, zbx_mem_free_func_t free_func)
+{
+	int	i;
+
+	for (i = 0; i < addresses->values_num; i++)
+		cloud_address_free(addresses->values[i], free_func);
+
+	zbx_vector_ptr_destroy(addresses);
+}
+
+static void	cloud_hardware_profile_free(zbx_deltacloud_hardware_profile_t *hwp, zbx_mem_free_func_t free_func)
 {
 	if (NULL != hwp->href)
-		__cloud_mem_free_func(hwp->href);
+		free_func(hwp->href);
 	if (NULL != hwp->id)
-		__cloud_mem_free_func(hwp->id);
+		free_func(hwp->id);
 	if (NULL != hwp->name)
-		__cloud_mem_free_func(hwp->name);
-	__cloud_mem_free_func(hwp);
+		free_func(hwp->name);
+	if (NULL != hwp->architecture)
+		free_func(hwp->architecture);
+	free_func(hwp);
+}
+
+static void	cloud_hardware_profile_shared_free(zbx_deltacloud_hardware_profile_t *hwp)
+{
+	cloud_hardware_profile_free(hwp, __cloud_mem_free_func);
 }
 
+static void	cloud_instance_cold_free(zbx_deltacloud_instance_cold_t *cold, zbx_mem_free_func_t free_func)
+{
+	if (NULL != cold->href)
+		free_func(cold->href);
+	if (NULL != cold->owner_id)
+		free_func(cold->owner_id);
+	if (NULL != cold->image_href)
+		free_func(cold->image_href);
+	if (NULL != cold->realm_href)
+		free_func(cold->realm_href);
+	if (NULL != cold->launch_time)
+		free_func(cold->launch_time);
+	free_func(cold);
+}
 
-static void	cloud_instance_shared_free(zbx_deltacloud_instance_t *instance)
+static void	cloud_instance_free(zbx_deltacloud_instance_t *instance, zbx_mem_free_func_t free_func)
 {
-	if (NULL != instance->href)
-		__cloud_mem_free_func(instance->href);
 	if (NULL != instance->id)
-		__cloud_mem_free_func(instance->id);
+		free_func(instance->id);
 	if (NULL != instance->name)
-		__cloud_mem_free_func(instance->name);
-	if (NULL != instance->owner_id)
-		__cloud_mem_free_func(instance->owner_id);
+		free_func(instance->name);
 	if (NULL != instance->image_id)
-		__cloud_mem_free_func(instance->image_id);
-	if (NULL != instance->image_href)
-		__cloud_mem_free_func(instance->image_href);
+		free_func(instance->image_id);
 	if (NULL != instance->realm_id)
-		__cloud_mem_free_func(instance->realm_id);
-	if (NULL != instance->realm_href)
-		__cloud_mem_free_func(instance->realm_href);
+		free_func(instance->realm_id);
 	if (NULL != instance->state)
-		__cloud_mem_free_func(instance->state);
-	if (NULL != instance->launch_time)
-		__cloud_mem_free_func(instance->launch_time);
-	__cloud_mem_free_func(instance);
-	zbx_vector_ptr_clean(&instance->public_addresses, (zbx_mem_free_func_t)cloud_address_shared_free);
-	zbx_vector_ptr_clean(&instance->private_addresses, (zbx_mem_free_func_t)cloud_address_shared_free);
-	zbx_vector_ptr_destroy(&instance->public_addresses);
-	zbx_vector_ptr_destroy(&instance->private_addresses);
-	cloud_hardware_profile_shared_free(instance->hwp);
-	zabbix_log(LOG_LEVEL_ERR, "--free instance-----used_size: %d---\n", cloud_mem->used_size);
+		free_func(instance->state);
+	if (NULL != instance->cold)
+		cloud_instance_cold_free(instance->cold, free_func);
+	cloud_addresses_clear(&instance->public_addresses, free_func);
+	cloud_addresses_clear(&instance->private_addresses, free_func);
+	free_func(instance);
 }
 
-static void	cloud_service_shared_free(zbx_deltacloud_service_t *service)
+static void	cloud_instance_shared_free(zbx_deltacloud_instance_t *instance)
 {
-	int i;
+	cloud_instance_free(instance, __cloud_mem_free_func);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: cloud_service_clear                                              *
+ *                                                                            *
+ * Purpose: free everything the service owns, but not the service itself      *
+ *                                                                            *
+ ******************************************************************************/
+static void	cloud_service_clear(zbx_deltacloud_service_t *service, zbx_mem_free_func_t free_func)
+{
+	int	i;
+
 	if (NULL != service->url)
-		__cloud_mem_free_func(service->url);
+		free_func(service->url);
 	if (NULL != service->key)
-		__cloud_mem_free_func(service->key);
+		free_func(service->key);
 	if (NULL != service->secret)
-		__cloud_mem_free_func(service->secret);
+		free_func(service->secret);
 	if (NULL != service->driver)
-		__cloud_mem_free_func(service->driver);
+		free_func(service->driver);
 	if (NULL != service->provider)
-		__cloud_mem_free_func(service->provider);
+		free_func(service->provider);
+	if (NULL != service->fleet)
+		free_func(service->fleet);
 
-	zbx_vector_ptr_clean(&service->instances, (zbx_mem_free_func_t)cloud_instance_shared_free);
+	for (i = 0; i < service->instances.values_num; i++)
+		cloud_instance_free(service->instances.values[i], free_func);
 	zbx_vector_ptr_destroy(&service->instances);
+
+	for (i = 0; i < service->hardware_profiles.values_num; i++)
+		cloud_hardware_profile_free(service->hardware_profiles.values[i], free_func);
+	zbx_vector_ptr_destroy(&service->hardware_profiles);
+
+	for (i = 0; i < CLOUD_COLLECTION_COUNT; i++)
+		cloud_resources_clear(&service->collections[i], free_func);
+
+	/* the index entries own nothing, the keys are freed with the instances */
+	zbx_hashset_destroy(&service->id_index);
+	zbx_hashset_destroy(&service->name_index);
+	zbx_hashset_destroy(&service->addr_index);
+}
+
+static void	cloud_service_shared_free(zbx_deltacloud_service_t *service)
+{
+	cloud_service_clear(service, __cloud_mem_free_func);
 	__cloud_mem_free_func(service);
 	zabbix_log(LOG_LEVEL_ERR, "--free service-----used_size: %d---\n", cloud_mem->used_size);
 }
@@ -1001,7 +6085,25 @@ static void	cloud_service_shared_free(zbx_deltacloud_service_t *service)
  ******************************************************************************/
 int	zbx_module_uninit()
 {
-	int i;
+	if (NULL != client_keys)
+	{
+		zbx_free(client_keys);
+		return ZBX_MODULE_OK;
+	}
+
+	cloud_views_free();
+
+	if (NULL != cloud_missing_ids.slots)
+	{
+		cloud_missing_ids_clear();
+		zbx_hashset_destroy(&cloud_missing_ids);
+	}
+
+	if (-1 != cloud_listener_pid)
+	{
+		kill(cloud_listener_pid, SIGTERM);
+		unlink(CONFIG_CACHE_SOCKET);
+	}
 
 	if (NULL != deltacloud)
 	{
@@ -1013,5 +6115,8 @@ int	zbx_module_uninit()
 	zbx_mem_destroy(cloud_mem);
 	zabbix_log(LOG_LEVEL_ERR, "----destroy cloud_mem---used_size: %d---\n", cloud_mem->used_size);
 
+	if (-1 != cloud_semid)
+		semctl(cloud_semid, 0, IPC_RMID, 0);
+
 	return ZBX_MODULE_OK;
 }